@@ -0,0 +1,245 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <atomic>
+#include <cstdlib>
+#include <cstddef>
+#include <memory_resource>
+
+#include <Fade_2D.h>
+
+using namespace GEOM_FADE2D;
+
+// PHASE ARENA
+
+/*
+Upstream of the arena: forwards to the heap and counts every call, so an allocation
+that did not fit the arena's buffer shows up in the statistics.
+*/
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+    size_t allocations = 0;
+    size_t bytes = 0;
+
+private:
+    void *do_allocate(size_t size, size_t alignment) override
+    {
+        allocations += 1;
+        bytes += size;
+        return std::pmr::new_delete_resource()->allocate(size, alignment);
+    }
+
+    void do_deallocate(void *pointer, size_t size, size_t alignment) override
+    {
+        std::pmr::new_delete_resource()->deallocate(pointer, size, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+/*
+Allocation counters of one arena over a run. overflows are allocations from resource()
+that did not fit the retained buffer and went to the heap during a phase; 0 means the
+buffer was large enough. Only scratch data taken from resource() is counted: plain
+std::vectors, std::functions, the transports' buffers and Fade's own allocations are not
+(HeapCalls counts those).
+*/
+struct ArenaStats
+{
+    size_t phases = 0;
+    size_t overflows = 0;
+    size_t peakBytes = 0; // most bytes handed out in one phase
+    size_t growths = 0;   // buffer enlargements, done between phases
+};
+
+/*
+Heap allocations of the whole process while counting is on, seen by the replaced global
+operator new below. main and runThreaded count over the phase loop, so the number covers
+everything the phases allocate: arena overflows, and also Fade's own allocations, plain
+std::vectors and the transports' buffers, which the arena does not back.
+*/
+struct HeapCalls
+{
+    static inline std::atomic<bool> counting{false};
+    static inline std::atomic<size_t> allocations{0};
+
+    static void start()
+    {
+        allocations.store(0, std::memory_order_relaxed);
+        counting.store(true, std::memory_order_relaxed);
+    }
+
+    static size_t stop()
+    {
+        counting.store(false, std::memory_order_relaxed);
+        return allocations.load(std::memory_order_relaxed);
+    }
+};
+
+// every executable is a single translation unit, so these replace the global operators once
+void *operator new(size_t size)
+{
+    if (HeapCalls::counting.load(std::memory_order_relaxed))
+    {
+        HeapCalls::allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (void *pointer = std::malloc(size ? size : 1))
+    {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    std::free(pointer);
+}
+
+/*
+Per-rank (or per-cell) monotonic arena for the transient state of one phase: std::pmr
+containers take memory from resource() by bumping a pointer, freeing is a no-op, and
+reset() at the start of the next phase rewinds the pointer in O(1). The retained buffer
+grows to the peak of a phase that overflowed it, so in steady state the scratch data of
+a phase takes no memory from the heap. The buffer is only allocated by the first reset(),
+a LocalMesh that is built, received or copied without running a phase costs nothing.
+
+Fade's out-parameters (getVertexPointers etc.) need plain std::vectors; those are kept
+here as well and only cleared, so their capacity survives the phase.
+*/
+class PhaseArena
+{
+private:
+    size_t capacity;
+    std::unique_ptr<std::byte[]> buffer;
+    CountingResource upstream;
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> monotonic;
+    size_t overflowsAtReset = 0;
+
+    // bytes handed out since the last reset, tracked through a thin counting layer
+    class Usage : public std::pmr::memory_resource
+    {
+    public:
+        std::pmr::memory_resource *target = nullptr;
+        size_t bytes = 0;
+
+    private:
+        void *do_allocate(size_t size, size_t alignment) override
+        {
+            bytes += size;
+            return target->allocate(size, alignment);
+        }
+
+        void do_deallocate(void *pointer, size_t size, size_t alignment) override
+        {
+            target->deallocate(pointer, size, alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+        {
+            return this == &other;
+        }
+    } usage;
+
+    void rebuild()
+    {
+        monotonic.reset();
+        buffer.reset(new std::byte[capacity]);
+        monotonic = std::make_unique<std::pmr::monotonic_buffer_resource>(buffer.get(), capacity, &upstream);
+        usage.target = monotonic.get();
+        usage.bytes = 0;
+    }
+
+public:
+    ArenaStats stats;
+
+    // reusable Fade out-parameters
+    std::vector<Point2 *> vertices;
+    std::vector<Point2 *> removed;
+    std::vector<Triangle2 *> triangles;
+    std::vector<Triangle2 *> zoneTriangles;
+    std::vector<ConstraintSegment2 *> segments;
+    std::vector<Segment2> pieces;
+
+    explicit PhaseArena(size_t capacity = size_t(16) << 20) : capacity(capacity) {}
+
+    // a copied LocalMesh starts with a fresh arena of the same size, allocated on its first phase
+    PhaseArena(const PhaseArena &other) : PhaseArena(other.capacity) {}
+
+    PhaseArena &operator=(const PhaseArena &other)
+    {
+        if (this != &other)
+        {
+            capacity = other.capacity;
+            monotonic.reset();
+            buffer.reset();
+        }
+        return *this;
+    }
+
+    /*
+    Give the capacity of the Fade out-parameters back (their mesh is leaving memory).
+    The buffer stays, it may still hold halos of the current phase.
+    */
+    void releaseScratch()
+    {
+        std::vector<Point2 *>().swap(vertices);
+        std::vector<Point2 *>().swap(removed);
+        std::vector<Triangle2 *>().swap(triangles);
+        std::vector<Triangle2 *>().swap(zoneTriangles);
+        std::vector<ConstraintSegment2 *>().swap(segments);
+        std::vector<Segment2>().swap(pieces);
+    }
+
+    std::pmr::memory_resource *resource()
+    {
+        if (!monotonic)
+        {
+            rebuild();
+        }
+        return &usage;
+    }
+
+    /*
+    End the current phase: everything allocated from resource() is gone.
+    If the phase overflowed the buffer, it grows to the phase's peak (one heap call, here and not in the loop).
+    The first reset only allocates the buffer, there was no phase before it.
+    */
+    void reset()
+    {
+        if (!monotonic)
+        {
+            rebuild();
+            overflowsAtReset = upstream.allocations;
+            return;
+        }
+        stats.phases += 1;
+        stats.overflows += upstream.allocations - overflowsAtReset;
+        stats.peakBytes = std::max(stats.peakBytes, usage.bytes);
+
+        bool overflowed = upstream.allocations != overflowsAtReset;
+        if (overflowed)
+        {
+            // headroom for alignment padding and the next, possibly larger, phase
+            capacity = std::max(2 * capacity, 2 * usage.bytes);
+            stats.growths += 1;
+            rebuild();
+        }
+        else
+        {
+            monotonic->release();
+            usage.bytes = 0;
+        }
+        overflowsAtReset = upstream.allocations;
+    }
+};
@@ -0,0 +1,295 @@
+#pragma once
+
+#include "transport.hpp"
+#include "sfc.hpp"
+
+// OVER-DECOMPOSITION
+
+/*
+Which rank holds each block of the grid, and at which position in its list of blocks.
+Blocks are numbered row * cols + col as in splitMesh, LocalMesh::neighbors hold block numbers.
+*/
+struct BlockRouting
+{
+    int blocksPerRank = 1;
+    std::vector<int> owner; // rank of every block
+    std::vector<int> slot;  // index of every block among the blocks of its rank
+
+    template <class Archive>
+    void serialize(Archive &archive, const unsigned /* version */)
+    {
+        archive & blocksPerRank;
+        archive & owner;
+        archive & slot;
+    }
+};
+
+/*
+Deal the cols x rows blocks of grid to nproc ranks, blocksPerRank each, as contiguous
+runs along the Hilbert curve through the block centers: the blocks of one rank form a
+compact patch, so most of their neighbors are on the same rank.
+With one block per rank, block b stays on rank b.
+*/
+BlockRouting assignBlocks(const BlockGrid &grid, int nproc, int blocksPerRank)
+{
+    int numBlocks = grid.cols() * grid.rows();
+    BlockRouting routing;
+    routing.blocksPerRank = blocksPerRank;
+    routing.owner.resize(numBlocks);
+    routing.slot.resize(numBlocks);
+
+    std::vector<std::pair<uint64_t, int>> order;
+    for (int block = 0; block < numBlocks; ++block)
+    {
+        uint64_t key = blocksPerRank == 1 ? uint64_t(block) : hilbertKey(uint32_t(block % grid.cols()), uint32_t(block / grid.cols()));
+        order.push_back({key, block});
+    }
+    std::sort(order.begin(), order.end());
+    for (int i = 0; i < numBlocks; ++i)
+    {
+        routing.owner[order[i].second] = i * nproc / numBlocks;
+        routing.slot[order[i].second] = i - routing.owner[order[i].second] * numBlocks / nproc;
+    }
+    return routing;
+}
+
+/*
+World ranks of every node, collectively on all ranks. Nodes are found by the shared memory
+split of world (as in ShmHaloTransport) and named by their lowest rank, in that order.
+*/
+std::vector<std::vector<int>> nodeRanks(const mpi::communicator &world)
+{
+    MPI_Comm node;
+    MPI_Comm_split_type(MPI_Comm(world), MPI_COMM_TYPE_SHARED, world.rank(), MPI_INFO_NULL, &node);
+    int leader = world.rank();
+    MPI_Allreduce(MPI_IN_PLACE, &leader, 1, MPI_INT, MPI_MIN, node);
+    MPI_Comm_free(&node);
+
+    std::vector<int> leaders;
+    mpi::all_gather(world, leader, leaders);
+    std::vector<std::vector<int>> nodes;
+    std::unordered_map<int, size_t> nodeOfLeader;
+    for (int rank = 0; rank < world.size(); ++rank)
+    {
+        // a leader is the lowest rank of its node, so it comes before all its members
+        if (leaders[rank] == rank)
+        {
+            nodeOfLeader[rank] = nodes.size();
+            nodes.push_back({});
+        }
+        nodes[nodeOfLeader[leaders[rank]]].push_back(rank);
+    }
+    return nodes;
+}
+
+/*
+Two-level counterpart of assignBlocks for a grid from splitMesh with nodeCols x nodeRows
+node regions: node n (row-major) gets all blocks of region n, dealt to its ranks along the
+Hilbert curve through the region. Every halo between two regions crosses nodes, all others
+stay inside a node. All nodes must have the same number of ranks.
+*/
+BlockRouting assignBlocksToNodes(const BlockGrid &grid, int nodeCols, int nodeRows, const std::vector<std::vector<int>> &nodes,
+                                 int blocksPerRank)
+{
+    int innerCols = grid.cols() / nodeCols, innerRows = grid.rows() / nodeRows;
+    BlockRouting routing;
+    routing.blocksPerRank = blocksPerRank;
+    routing.owner.resize(grid.cols() * grid.rows());
+    routing.slot.resize(grid.cols() * grid.rows());
+
+    for (int node = 0; node < nodeCols * nodeRows; ++node)
+    {
+        int firstCol = (node % nodeCols) * innerCols, firstRow = (node / nodeCols) * innerRows;
+        std::vector<std::pair<uint64_t, int>> order;
+        for (int row = firstRow; row < firstRow + innerRows; ++row)
+        {
+            for (int col = firstCol; col < firstCol + innerCols; ++col)
+            {
+                order.push_back({hilbertKey(uint32_t(col - firstCol), uint32_t(row - firstRow)), row * grid.cols() + col});
+            }
+        }
+        std::sort(order.begin(), order.end());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            routing.owner[order[i].second] = nodes[node][i / blocksPerRank];
+            routing.slot[order[i].second] = int(i % blocksPerRank);
+        }
+    }
+    return routing;
+}
+
+/*
+Block numbers of every rank in slot order. Rank 0 builds and sends the blocks one at a time
+along these lists (see GlobalMesh::fillBlock), LocalMeshes themselves are never moved.
+*/
+std::vector<std::vector<size_t>> distributeBlocks(const BlockRouting &routing, int nproc)
+{
+    std::vector<std::vector<size_t>> perRank(nproc, std::vector<size_t>(routing.blocksPerRank));
+    for (size_t block = 0; block < routing.owner.size(); ++block)
+    {
+        perRank[routing.owner[block]][routing.slot[block]] = block;
+    }
+    return perRank;
+}
+
+/*
+With one block per rank, neighbors are rewritten from block numbers to the owners' ranks,
+which is what the single block transports address. Several blocks per rank keep block numbers.
+*/
+void routeNeighbors(LocalMesh &localMesh, const BlockRouting &routing)
+{
+    if (routing.blocksPerRank != 1)
+    {
+        return;
+    }
+    for (auto &[direction, neighbor] : localMesh.neighbors)
+    {
+        if (neighbor.has_value())
+        {
+            neighbor = size_t(routing.owner[neighbor.value()]);
+        }
+    }
+}
+
+/*
+State the block transports of one rank share: the communicator of their remote messages
+and the inboxes of the halos between its own blocks (per slot, indexed by the direction
+of the sender). The rank runs its blocks one after another, so the inboxes need no locking.
+*/
+class BlockExchange
+{
+public:
+    MPI_Comm comm = MPI_COMM_NULL;
+    std::vector<std::array<std::unique_ptr<HaloPayload>, 8>> inboxes;
+
+    BlockExchange(const mpi::communicator &world, size_t numBlocks) : inboxes(numBlocks)
+    {
+        MPI_Comm_dup(MPI_Comm(world), &comm);
+    }
+
+    BlockExchange(const BlockExchange &) = delete;
+    BlockExchange &operator=(const BlockExchange &) = delete;
+
+    ~BlockExchange()
+    {
+        MPI_Comm_free(&comm);
+    }
+};
+
+/*
+Whether the largest tag of BlockHaloTransport (phase 63, the last slot, direction 7) stays
+within the MPI_TAG_UB of world for blocksPerRank blocks per rank.
+*/
+bool blockTagsFit(const mpi::communicator &world, int blocksPerRank)
+{
+    int *tagUpperBound = nullptr;
+    int found = 0;
+    MPI_Comm_get_attr(MPI_Comm(world), MPI_TAG_UB, &tagUpperBound, &found);
+    long long largestTag = 64LL * 8 * blocksPerRank;
+    return found && largestTag <= *tagUpperBound;
+}
+
+/*
+Halo transport of one block when a rank holds several. A halo to a block of the same
+rank is moved into that block's inbox (no MPI, no packing), a halo to a block of another
+rank goes out as in RawHaloTransport. Remote messages are told apart by the receiving block's slot and the direction in the tag,
+the phase only modulo 64 (neighbors are never that far apart), which keeps tags below
+the guaranteed MPI_TAG_UB of 32767 for up to 63 blocks per rank (see blockTagsFit).
+All blocks of a rank must start a phase before any of them completes it (see runPhase).
+*/
+class BlockHaloTransport : public RawHaloTransport
+{
+private:
+    const BlockRouting &routing;
+    BlockExchange &exchange;
+    int rank;
+    int slot;
+    std::vector<Neighbor> localSources;
+
+    bool isLocal(Neighbor neighbor) const
+    {
+        return routing.owner[localMesh.neighbors.at(neighbor).value()] == rank;
+    }
+
+    int blockTag(int phase, int receiverSlot, Neighbor fromDirection) const
+    {
+        return 1 + ((phase % 64) * routing.blocksPerRank + receiverSlot) * 8 + int(fromDirection);
+    }
+
+protected:
+    int peerRank(Neighbor neighbor) const override
+    {
+        return routing.owner[localMesh.neighbors.at(neighbor).value()];
+    }
+
+    int receiveTag(int phase, Neighbor source) const override
+    {
+        return blockTag(phase, slot, source);
+    }
+
+    int sendTag(int phase, Neighbor target) const override
+    {
+        return blockTag(phase, routing.slot[localMesh.neighbors.at(target).value()], opposite(target));
+    }
+
+public:
+    BlockHaloTransport(const mpi::communicator &world, LocalMesh &localMesh, const BlockRouting &routing, BlockExchange &exchange, int slot)
+        : RawHaloTransport(exchange.comm, localMesh), routing(routing), exchange(exchange), rank(world.rank()), slot(slot) {}
+
+    const char *name() const override { return "blocks"; }
+
+    void postReceives(int phase, const std::vector<Neighbor> &sources) override
+    {
+        localSources.clear();
+        std::vector<Neighbor> remoteSources;
+        for (Neighbor source : sources)
+        {
+            (isLocal(source) ? localSources : remoteSources).push_back(source);
+        }
+        RawHaloTransport::postReceives(phase, remoteSources);
+    }
+
+    void send(int phase, Neighbor target, HaloPayload payload) override
+    {
+        if (!isLocal(target))
+        {
+            RawHaloTransport::send(phase, target, std::move(payload));
+            return;
+        }
+        HaloTimer timer(stats);
+        stats.messages += 1;
+        stats.bytes += haloBytes(payload);
+        int targetSlot = routing.slot[localMesh.neighbors.at(target).value()];
+        exchange.inboxes[targetSlot][int(opposite(target))] = std::make_unique<HaloPayload>(std::move(payload));
+    }
+
+    void complete(const std::function<void(Neighbor, HaloPayload &)> &deliver) override
+    {
+        {
+            HaloTimer timer(stats);
+            for (Neighbor source : localSources)
+            {
+                std::unique_ptr<HaloPayload> payload = std::move(exchange.inboxes[slot][int(source)]);
+                if (payload)
+                {
+                    deliver(source, *payload);
+                }
+            }
+        }
+        RawHaloTransport::complete(deliver);
+    }
+};
+
+/*
+One BlockHaloTransport per block of this rank, exchange must outlive them.
+*/
+std::vector<std::unique_ptr<HaloTransport>> makeBlockTransports(const mpi::communicator &world, std::vector<LocalMesh> &localMeshes,
+                                                                const BlockRouting &routing, BlockExchange &exchange)
+{
+    std::vector<std::unique_ptr<HaloTransport>> transports;
+    for (size_t slot = 0; slot < localMeshes.size(); ++slot)
+    {
+        transports.push_back(std::make_unique<BlockHaloTransport>(world, localMeshes[slot], routing, exchange, int(slot)));
+    }
+    return transports;
+}
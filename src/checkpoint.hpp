@@ -0,0 +1,258 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+
+#include "main.hpp"
+
+// CHECKPOINT
+
+/*
+Per-rank binary checkpoint of a LocalMesh, written after a phase has completed
+(all halo messages of the phase are delivered, so the LocalMesh is the whole state).
+
+Layout of <dir>/rank<r>.phase<p>.ckpt, native endianness:
+    char[8]   magic "DMRCKPT"
+    uint32    version
+    int32     phase, rank, nproc
+    double[4] bbox (minX, minY, maxX, maxY)
+    double    maxCircumradius
+    int64[8]  neighbors in allNeighbors order, -1 if none
+    uint8     constrained
+    double, uint8, uint64 + double[]      exteriorParity (minY, parityAtMinY, breaks)
+    uint64 + double[4n]                   constraints (original local boundary pieces)
+    uint64 + double[2n]                   mesh vertices
+    uint64 + double[4n]                   alive constraint pieces of the mesh (after splits)
+    uint64 + double[n]                    heights of the vertices, NaN if none (empty if not a terrain)
+    uint64 + double[3n]                   terrain samples x y z (see LocalMesh::samples)
+
+The triangulation itself is not stored: it is the constrained Delaunay triangulation of
+the vertices and the alive pieces, so it is rebuilt by a bulk insert on restart.
+<dir>/latest holds the last phase for which every rank has finished writing.
+*/
+
+const char checkpointMagic[8] = "DMRCKPT";
+const uint32_t checkpointVersion = 3;
+
+std::string checkpointPath(const std::string &dir, int rank, int phase)
+{
+    return dir + "/rank" + std::to_string(rank) + ".phase" + std::to_string(phase) + ".ckpt";
+}
+
+/*
+Write localMesh to path. The file is written under a temporary name and renamed,
+so a crash while writing never leaves a truncated checkpoint behind.
+*/
+bool saveCheckpoint(LocalMesh &localMesh, const std::string &path, int phase, int rank, int nproc)
+{
+    std::string tmpPath = path + ".tmp";
+    std::ofstream stream(tmpPath, std::ios::binary);
+    if (!stream.is_open())
+    {
+        std::cout << "Can't write checkpoint " << tmpPath << std::endl;
+        return false;
+    }
+
+    stream.write(checkpointMagic, sizeof(checkpointMagic));
+    writeBinary(stream, checkpointVersion);
+    writeBinary(stream, int32_t(phase));
+    writeBinary(stream, int32_t(rank));
+    writeBinary(stream, int32_t(nproc));
+
+    Bbox2 &bbox = localMesh.bbox;
+    for (double value : {bbox.get_minX(), bbox.get_minY(), bbox.get_maxX(), bbox.get_maxY(), localMesh.maxCircumradius})
+    {
+        writeBinary(stream, value);
+    }
+    for (Neighbor neighbor : allNeighbors)
+    {
+        std::optional<size_t> rankOfNeighbor = localMesh.neighbors[neighbor];
+        writeBinary(stream, int64_t(rankOfNeighbor.has_value() ? int64_t(rankOfNeighbor.value()) : -1));
+    }
+
+    writeBinary(stream, uint8_t(localMesh.constrained));
+    writeBinary(stream, localMesh.exteriorParity.minY);
+    writeBinary(stream, uint8_t(localMesh.exteriorParity.parityAtMinY));
+    writeDoubles(stream, localMesh.exteriorParity.breaks);
+    writeDoubles(stream, flattenSegments(localMesh.constraints));
+
+    std::vector<Point2 *> vertices;
+    localMesh.mesh.getVertexPointers(vertices);
+    std::vector<double> coordinates;
+    coordinates.reserve(2 * vertices.size());
+    for (auto &vertex : vertices)
+    {
+        coordinates.push_back(vertex->x());
+        coordinates.push_back(vertex->y());
+    }
+    writeDoubles(stream, coordinates);
+
+    std::vector<ConstraintSegment2 *> alive;
+    localMesh.mesh.getAliveConstraintSegments(alive);
+    std::vector<Segment2> pieces;
+    pieces.reserve(alive.size());
+    for (auto &segment : alive)
+    {
+        pieces.push_back(Segment2(*segment->getSrc(), *segment->getTrg()));
+    }
+    writeDoubles(stream, flattenSegments(pieces));
+
+    std::vector<double> heights;
+    if (!localMesh.heights.empty())
+    {
+        heights.reserve(vertices.size());
+        for (auto &vertex : vertices)
+        {
+            heights.push_back(localMesh.heights.has(*vertex) ? localMesh.heights.at(*vertex) : std::nan(""));
+        }
+    }
+    writeDoubles(stream, heights);
+    writeDoubles(stream, localMesh.samples);
+
+    stream.close();
+    if (!stream || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        std::cout << "Can't write checkpoint " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/*
+Read a checkpoint written by saveCheckpoint into an empty localMesh.
+Fails if the file is missing, truncated or was written for another rank layout.
+*/
+bool loadCheckpoint(LocalMesh &localMesh, const std::string &path, int phase, int rank, int nproc)
+{
+    std::ifstream stream(path, std::ios::binary);
+    char magic[8];
+    uint32_t version;
+    int32_t filePhase, fileRank, fileNproc;
+    if (!stream.read(magic, sizeof(magic)) || std::string(magic, sizeof(magic)) != std::string(checkpointMagic, sizeof(checkpointMagic)) ||
+        !readBinary(stream, version) || version != checkpointVersion ||
+        !readBinary(stream, filePhase) || !readBinary(stream, fileRank) || !readBinary(stream, fileNproc) ||
+        filePhase != phase || fileRank != rank || fileNproc != nproc)
+    {
+        std::cout << "Invalid checkpoint " << path << std::endl;
+        return false;
+    }
+
+    double minX, minY, maxX, maxY;
+    readBinary(stream, minX);
+    readBinary(stream, minY);
+    readBinary(stream, maxX);
+    readBinary(stream, maxY);
+    readBinary(stream, localMesh.maxCircumradius);
+    localMesh.bbox.setMinX(minX);
+    localMesh.bbox.setMinY(minY);
+    localMesh.bbox.setMaxX(maxX);
+    localMesh.bbox.setMaxY(maxY);
+
+    for (Neighbor neighbor : allNeighbors)
+    {
+        int64_t rankOfNeighbor;
+        readBinary(stream, rankOfNeighbor);
+        localMesh.neighbors[neighbor] = rankOfNeighbor < 0 ? std::nullopt : std::optional<size_t>(size_t(rankOfNeighbor));
+    }
+
+    uint8_t constrained, parityAtMinY;
+    std::vector<double> constraintData, coordinates, pieceData, heights;
+    readBinary(stream, constrained);
+    readBinary(stream, localMesh.exteriorParity.minY);
+    readBinary(stream, parityAtMinY);
+    if (!readDoubles(stream, localMesh.exteriorParity.breaks) || !readDoubles(stream, constraintData) ||
+        !readDoubles(stream, coordinates) || !readDoubles(stream, pieceData) || !readDoubles(stream, heights) ||
+        !readDoubles(stream, localMesh.samples))
+    {
+        std::cout << "Truncated checkpoint " << path << std::endl;
+        return false;
+    }
+    localMesh.constrained = constrained != 0;
+    localMesh.exteriorParity.parityAtMinY = parityAtMinY != 0;
+    localMesh.constraints = unflattenSegments(constraintData);
+
+    std::vector<Point2> vertices;
+    vertices.reserve(coordinates.size() / 2);
+    localMesh.heights = HeightTable();
+    for (size_t i = 0; i + 1 < coordinates.size(); i += 2)
+    {
+        vertices.push_back(Point2(coordinates[i], coordinates[i + 1]));
+        if (i / 2 < heights.size() && !std::isnan(heights[i / 2]))
+        {
+            localMesh.heights.assign(vertices.back(), heights[i / 2]);
+        }
+    }
+    localMesh.heights.bind(vertices, bulkInsert(localMesh.mesh, vertices, localMesh.insertionOrder, &localMesh.insertionStats));
+
+    std::vector<Segment2> pieces = unflattenSegments(pieceData);
+    if (!pieces.empty())
+    {
+        localMesh.mesh.createConstraint(pieces, CIS_CONSTRAINED_DELAUNAY);
+    }
+    return true;
+}
+
+/*
+Collectively checkpoint the local meshes of all ranks after phase.
+Only once every rank has written its file does rank 0 advance <dir>/latest,
+and only then are the files of the previous checkpoint removed.
+*/
+void checkpointPhase(mpi::communicator &world, const std::string &dir, LocalMesh &localMesh, int phase)
+{
+    bool written = saveCheckpoint(localMesh, checkpointPath(dir, world.rank(), phase), phase, world.rank(), world.size());
+    bool allWritten = mpi::all_reduce(world, written, std::logical_and<bool>());
+    if (!allWritten)
+    {
+        if (world.rank() == 0) std::cout << "Checkpoint after phase " << phase << " incomplete, keeping the previous one" << std::endl;
+        return;
+    }
+
+    int previousPhase = -1;
+    if (world.rank() == 0)
+    {
+        std::ifstream latestIn(dir + "/latest");
+        latestIn >> previousPhase;
+        latestIn.close();
+
+        std::ofstream latestOut(dir + "/latest.tmp");
+        latestOut << phase << std::endl;
+        latestOut.close();
+        std::rename((dir + "/latest.tmp").c_str(), (dir + "/latest").c_str());
+    }
+    mpi::broadcast(world, previousPhase, 0);
+
+    if (previousPhase >= 0 && previousPhase != phase)
+    {
+        std::remove(checkpointPath(dir, world.rank(), previousPhase).c_str());
+    }
+}
+
+/*
+Collectively restore the local meshes from the last complete checkpoint in dir.
+Returns the phase the checkpoint was taken after, or -1 if there is none (then run from scratch).
+*/
+int restoreCheckpoint(mpi::communicator &world, const std::string &dir, LocalMesh &localMesh)
+{
+    int phase = -1;
+    if (world.rank() == 0)
+    {
+        std::ifstream latest(dir + "/latest");
+        if (!(latest >> phase))
+        {
+            phase = -1;
+        }
+    }
+    mpi::broadcast(world, phase, 0);
+    if (phase < 0)
+    {
+        return -1;
+    }
+
+    bool loaded = loadCheckpoint(localMesh, checkpointPath(dir, world.rank(), phase), phase, world.rank(), world.size());
+    if (!mpi::all_reduce(world, loaded, std::logical_and<bool>()))
+    {
+        if (world.rank() == 0) std::cout << "Can't restore checkpoint of phase " << phase << std::endl;
+        world.abort(1);
+    }
+    return phase;
+}
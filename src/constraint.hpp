@@ -0,0 +1,454 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#include <Fade_2D.h>
+
+using namespace GEOM_FADE2D;
+
+// CONSTRAINTS
+
+/*
+All the lines that any block or task box of the phase schedule can have as a border:
+every block edge and block midline, shifted by 0, +-r and +-2r.
+Splitting constraint segments at these lines means that no piece ever straddles a halo,
+refine or send box, so neighboring ranks always hold identical pieces.
+*/
+std::vector<double> gridLines(const std::vector<double> &blockEdges, double r)
+{
+    std::vector<double> lines;
+    for (size_t i = 0; i < blockEdges.size(); ++i)
+    {
+        std::vector<double> bases = {blockEdges[i]};
+        if (i + 1 < blockEdges.size())
+        {
+            bases.push_back((blockEdges[i] + blockEdges[i + 1]) / 2);
+        }
+        for (double base : bases)
+        {
+            for (double offset : {-2 * r, -r, 0.0, r, 2 * r})
+            {
+                lines.push_back(base + offset);
+            }
+        }
+    }
+
+    std::sort(lines.begin(), lines.end());
+    lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+    return lines;
+}
+
+/*
+Walk a segment across the cells spanned by the given vertical (xLines) and horizontal (yLines)
+lines in DDA fashion, i.e. visiting the crossings in the order of travel without sorting,
+and call visit(piece) for the part of the segment inside each cell.
+The split points only depend on the segment and the lines, never on the block that asks,
+so two ranks walking the same input segment produce bit-identical pieces.
+*/
+template <class Visit>
+void walkSegment(const Segment2 &segment, const std::vector<double> &xLines, const std::vector<double> &yLines, Visit visit)
+{
+    Point2 src = segment.getSrc();
+    Point2 trg = segment.getTrg();
+    double dx = trg.x() - src.x();
+    double dy = trg.y() - src.y();
+
+    // index of the next line crossed along one axis and the direction in which the index advances
+    auto firstLine = [](const std::vector<double> &lines, double from, double delta, long &step) -> long
+    {
+        if (delta > 0)
+        {
+            step = 1;
+            return std::upper_bound(lines.begin(), lines.end(), from) - lines.begin();
+        }
+        step = -1;
+        return long(std::lower_bound(lines.begin(), lines.end(), from) - lines.begin()) - 1;
+    };
+    auto nextT = [](const std::vector<double> &lines, long i, double from, double delta, double to) -> double
+    {
+        if (delta == 0 || i < 0 || i >= long(lines.size()) || (delta > 0 ? lines[i] >= to : lines[i] <= to))
+        {
+            return 1.0;
+        }
+        return (lines[i] - from) / delta;
+    };
+
+    long xStep, yStep;
+    long xi = firstLine(xLines, src.x(), dx, xStep);
+    long yi = firstLine(yLines, src.y(), dy, yStep);
+
+    Point2 previous = src;
+    while (true)
+    {
+        double tx = nextT(xLines, xi, src.x(), dx, trg.x());
+        double ty = nextT(yLines, yi, src.y(), dy, trg.y());
+        double t = std::min(tx, ty);
+        if (t >= 1.0)
+        {
+            break;
+        }
+
+        // a corner crossing advances both axes at once
+        if (tx == t)
+        {
+            xi += xStep;
+        }
+        if (ty == t)
+        {
+            yi += yStep;
+        }
+
+        Point2 next(src.x() + t * dx, src.y() + t * dy);
+        visit(Segment2(previous, next));
+        previous = next;
+    }
+    visit(Segment2(previous, trg));
+}
+
+/*
+Split every segment at the given vertical (xLines) and horizontal (yLines) lines.
+*/
+std::vector<Segment2> splitSegments(const std::vector<Segment2> &segments, const std::vector<double> &xLines, const std::vector<double> &yLines)
+{
+    std::vector<Segment2> pieces;
+    for (auto &segment : segments)
+    {
+        walkSegment(segment, xLines, yLines, [&](const Segment2 &piece)
+                    { pieces.push_back(piece); });
+    }
+    return pieces;
+}
+
+/*
+Read closed polygons (outer boundaries and holes) from a text file: one "x y" vertex per line,
+polygons separated by blank lines, each closed from its last vertex back to its first.
+Other lines (e.g. # comments) are skipped.
+*/
+bool readPolygons(const std::string &path, std::vector<std::vector<Segment2>> &polygons)
+{
+    std::ifstream stream(path);
+    if (!stream.is_open())
+    {
+        std::cout << "Can't read boundary " << path << std::endl;
+        return false;
+    }
+    std::vector<Point2> vertices;
+    auto close = [&]()
+    {
+        if (vertices.size() >= 3)
+        {
+            std::vector<Segment2> polygon;
+            for (size_t i = 0; i < vertices.size(); ++i)
+            {
+                polygon.push_back(Segment2(vertices[i], vertices[(i + 1) % vertices.size()]));
+            }
+            polygons.push_back(polygon);
+        }
+        vertices.clear();
+    };
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        std::istringstream fields(line);
+        double x, y;
+        if (fields >> x >> y)
+        {
+            vertices.push_back(Point2(x, y));
+        }
+        else if (line.find_first_not_of(" \t\r") == std::string::npos)
+        {
+            close();
+        }
+    }
+    close();
+    return true;
+}
+
+/*
+Segments as flat (x0, y0, x1, y1) doubles, for archives and binary files.
+*/
+std::vector<double> flattenSegments(const std::vector<Segment2> &segments)
+{
+    std::vector<double> data;
+    data.reserve(4 * segments.size());
+    for (auto &segment : segments)
+    {
+        data.insert(data.end(), {segment.getSrc().x(), segment.getSrc().y(), segment.getTrg().x(), segment.getTrg().y()});
+    }
+    return data;
+}
+
+std::vector<Segment2> unflattenSegments(const std::vector<double> &data)
+{
+    std::vector<Segment2> segments;
+    segments.reserve(data.size() / 4);
+    for (size_t i = 0; i + 3 < data.size(); i += 4)
+    {
+        segments.push_back(Segment2(Point2(data[i], data[i + 1]), Point2(data[i + 2], data[i + 3])));
+    }
+    return segments;
+}
+
+Point2 segmentMidpoint(const Segment2 &segment)
+{
+    Point2 src = segment.getSrc();
+    Point2 trg = segment.getTrg();
+    return Point2((src.x() + trg.x()) / 2, (src.y() + trg.y()) / 2);
+}
+
+/*
+Even-odd crossing rule for a horizontal ray from (x, y) towards +x.
+Half-open in y so a ray through a shared endpoint is counted exactly once.
+*/
+bool crossesRay(const Segment2 &segment, double x, double y)
+{
+    Point2 src = segment.getSrc();
+    Point2 trg = segment.getTrg();
+    if ((src.y() > y) == (trg.y() > y))
+    {
+        return false;
+    }
+    double crossingX = src.x() + (y - src.y()) * (trg.x() - src.x()) / (trg.y() - src.y());
+    return crossingX > x;
+}
+
+/*
+Parity of the boundary crossings to the right of a local mesh's halo, as a function of y.
+A rank only holds the constraint pieces inside its halo, so the part of an inside/outside
+ray test that leaves the halo is precomputed on the root from the global boundary.
+*/
+struct ExteriorParity
+{
+    double minY = 0;
+    bool parityAtMinY = false;
+    std::vector<double> breaks; // sorted y values in (minY, maxY] at which the parity flips
+
+    bool at(double y) const
+    {
+        size_t flips = std::upper_bound(breaks.begin(), breaks.end(), y) - breaks.begin();
+        return parityAtMinY != (flips % 2 == 1);
+    }
+
+    template <class Archive>
+    void serialize(Archive &archive, const unsigned /* version */)
+    {
+        archive & minY;
+        archive & parityAtMinY;
+        archive & breaks;
+    }
+};
+
+/*
+Build the exterior parity of the halo box from all pieces lying to its right.
+Pieces must have been split at halo.get_maxX() (see gridLines) so none of them straddles it.
+*/
+ExteriorParity computeExteriorParity(const std::vector<Segment2> &pieces, const Bbox2 &halo)
+{
+    ExteriorParity parity;
+    parity.minY = halo.get_minY();
+    for (auto &piece : pieces)
+    {
+        if (segmentMidpoint(piece).x() <= halo.get_maxX())
+        {
+            continue;
+        }
+        double lo = std::min(piece.getSrc().y(), piece.getTrg().y());
+        double hi = std::max(piece.getSrc().y(), piece.getTrg().y());
+        if (lo == hi)
+        {
+            continue;
+        }
+
+        // the piece crosses rays with lo <= y < hi
+        if (lo <= parity.minY && parity.minY < hi)
+        {
+            parity.parityAtMinY = !parity.parityAtMinY;
+        }
+        for (double y : {lo, hi})
+        {
+            if (y > parity.minY && y <= halo.get_maxY())
+            {
+                parity.breaks.push_back(y);
+            }
+        }
+    }
+    std::sort(parity.breaks.begin(), parity.breaks.end());
+    return parity;
+}
+
+/*
+Half-open ownership test of a block: p belongs to owned if it lies in [min, max) on both axes,
+so a point on a grid line shared by two blocks belongs to exactly one of them (the one it is
+the min edge of, as seamSide sees it). Barycenters never lie on the outer domain border.
+*/
+inline bool ownsPoint(const Bbox2 &owned, const Point2 &p)
+{
+    return p.x() >= owned.get_minX() && p.x() < owned.get_maxX() && p.y() >= owned.get_minY() && p.y() < owned.get_maxY();
+}
+
+/*
+Uniform grid of blocks produced by GlobalMesh::splitMesh.
+rank = row * cols() + col, row 0 on the minY side. Every block owns a halo of width 2r.
+*/
+struct BlockGrid
+{
+    std::vector<double> xEdges, yEdges;
+    double r = 0;
+
+    int cols() const { return int(xEdges.size()) - 1; }
+    int rows() const { return int(yEdges.size()) - 1; }
+
+    Bbox2 block(int row, int col) const
+    {
+        Bbox2 bbox;
+        bbox.setMinX(xEdges[col]);
+        bbox.setMinY(yEdges[row]);
+        bbox.setMaxX(xEdges[col + 1]);
+        bbox.setMaxY(yEdges[row + 1]);
+        return bbox;
+    }
+
+    Bbox2 halo(int row, int col) const
+    {
+        Bbox2 bbox;
+        bbox.setMinX(xEdges[col] - 2 * r);
+        bbox.setMinY(yEdges[row] - 2 * r);
+        bbox.setMaxX(xEdges[col + 1] + 2 * r);
+        bbox.setMaxY(yEdges[row + 1] + 2 * r);
+        return bbox;
+    }
+
+    /*
+    Range [first, last] of the blocks along one axis whose halo contains coord.
+    O(1) on the uniform grid, empty (first > last) if coord is outside every halo.
+    */
+    void haloRange(const std::vector<double> &edges, double coord, int &first, int &last) const
+    {
+        int count = int(edges.size()) - 1;
+        double width = (edges.back() - edges.front()) / count;
+        first = std::max(0, int(std::floor((coord - edges.front() - 2 * r) / width)) - 1);
+        last = std::min(count - 1, int(std::floor((coord - edges.front() + 2 * r) / width)) + 1);
+
+        // the estimate may be off by one at the halo borders, trim it with exact tests
+        while (first <= last && edges[first + 1] + 2 * r < coord)
+        {
+            ++first;
+        }
+        while (last >= first && edges[last] - 2 * r > coord)
+        {
+            --last;
+        }
+    }
+};
+
+/*
+Boundary pieces assigned to the blocks of a grid, indexed by block, ready for the scatter.
+*/
+struct ClippedBoundary
+{
+    std::vector<std::vector<Segment2>> pieces;
+    std::vector<ExteriorParity> parities;
+};
+
+/*
+Clip all boundary segments against the blocks they cross.
+Each segment is walked through the grid lines (walkSegment) and every resulting piece is
+handed to the O(1) range of blocks whose halo contains it, instead of testing it against all
+blocks. Segments are processed in contiguous chunks by numThreads threads into thread-local
+per-rank lists, which are concatenated in chunk order so the output does not depend on timing.
+*/
+ClippedBoundary clipToBlocks(const std::vector<Segment2> &segments, const BlockGrid &grid, int numThreads)
+{
+    int cols = grid.cols(), rows = grid.rows();
+    std::vector<double> xLines = gridLines(grid.xEdges, grid.r);
+    std::vector<double> yLines = gridLines(grid.yEdges, grid.r);
+    numThreads = std::max(1, numThreads);
+
+    // per thread: pieces of every rank, and pieces touching the halo band of every row
+    std::vector<std::vector<std::vector<Segment2>>> threadPieces(numThreads, std::vector<std::vector<Segment2>>(rows * cols));
+    std::vector<std::vector<std::vector<Segment2>>> threadRows(numThreads, std::vector<std::vector<Segment2>>(rows));
+
+    auto clipChunk = [&](int thread)
+    {
+        size_t begin = segments.size() * thread / numThreads;
+        size_t end = segments.size() * (thread + 1) / numThreads;
+        for (size_t i = begin; i < end; ++i)
+        {
+            walkSegment(segments[i], xLines, yLines, [&](const Segment2 &piece)
+                        {
+                Point2 mid = segmentMidpoint(piece);
+                int firstCol, lastCol, firstRow, lastRow;
+                grid.haloRange(grid.xEdges, mid.x(), firstCol, lastCol);
+                grid.haloRange(grid.yEdges, mid.y(), firstRow, lastRow);
+                for (int row = firstRow; row <= lastRow; ++row)
+                {
+                    for (int col = firstCol; col <= lastCol; ++col)
+                    {
+                        threadPieces[thread][row * cols + col].push_back(piece);
+                    }
+
+                    // pieces anywhere in the row's halo band are needed for the exterior parity,
+                    // a piece never straddles a halo line so its midpoint decides the band
+                    threadRows[thread][row].push_back(piece);
+                } });
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < numThreads; ++thread)
+    {
+        threads.emplace_back(clipChunk, thread);
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    ClippedBoundary result;
+    result.pieces.resize(rows * cols);
+    result.parities.resize(rows * cols);
+    std::vector<std::vector<Segment2>> rowPieces(rows);
+    for (int thread = 0; thread < numThreads; ++thread)
+    {
+        for (int rank = 0; rank < rows * cols; ++rank)
+        {
+            auto &from = threadPieces[thread][rank];
+            result.pieces[rank].insert(result.pieces[rank].end(), from.begin(), from.end());
+        }
+        for (int row = 0; row < rows; ++row)
+        {
+            auto &from = threadRows[thread][row];
+            rowPieces[row].insert(rowPieces[row].end(), from.begin(), from.end());
+        }
+    }
+
+    // exterior parity only looks at the pieces of the block's own row band
+    threads.clear();
+    auto parityRows = [&](int thread)
+    {
+        for (int row = thread; row < rows; row += numThreads)
+        {
+            for (int col = 0; col < cols; ++col)
+            {
+                result.parities[row * cols + col] = computeExteriorParity(rowPieces[row], grid.halo(row, col));
+            }
+        }
+    };
+    for (int thread = 0; thread < numThreads; ++thread)
+    {
+        threads.emplace_back(parityRows, thread);
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    return result;
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <mpi.h>
+
+#include "halo.hpp"
+
+// CONVERGENCE
+
+/*
+Global count of bad triangles as a non-blocking sum over all ranks (MPI_Iallreduce on
+a duplicate of world, so it never matches other collectives). start contributes the
+local count, wait blocks until every rank has contributed and returns the sum. A rank
+that has nothing left to do sits in wait without spinning.
+*/
+class ConvergenceCheck
+{
+private:
+    MPI_Comm comm = MPI_COMM_NULL;
+    MPI_Request request = MPI_REQUEST_NULL;
+    unsigned long long local = 0, global = 0;
+
+public:
+    ConvergenceCheck(mpi::communicator &world)
+    {
+        MPI_Comm_dup(MPI_Comm(world), &comm);
+    }
+
+    ~ConvergenceCheck()
+    {
+        if (request != MPI_REQUEST_NULL)
+        {
+            MPI_Wait(&request, MPI_STATUS_IGNORE);
+        }
+        MPI_Comm_free(&comm);
+    }
+
+    void start(size_t badTriangles)
+    {
+        local = badTriangles;
+        MPI_Iallreduce(&local, &global, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm, &request);
+    }
+
+    size_t wait()
+    {
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+        return size_t(global);
+    }
+};
+
+/*
+Tell the neighbors of every block whether flags[block] holds, as the converged flag of an
+empty halo, in one phase of its own (all blocks start before any finishes, as in runPhase).
+Returns the flags of the neighbors per block, indexed by direction. Missing neighbors read
+as false, and so do all flags over the boost transport, which does not carry the header.
+*/
+std::vector<std::array<bool, 8>> exchangeFlags(std::vector<LocalMesh> &localMeshes, const std::vector<bool> &flags, int phase,
+                                               const std::vector<HaloTransport *> &transports)
+{
+    std::vector<std::array<bool, 8>> neighborFlags(localMeshes.size());
+    for (size_t block = 0; block < localMeshes.size(); ++block)
+    {
+        neighborFlags[block].fill(false);
+        std::vector<Neighbor> neighbors;
+        for (Neighbor neighbor : allNeighbors)
+        {
+            if (localMeshes[block].neighbors[neighbor].has_value())
+            {
+                neighbors.push_back(neighbor);
+            }
+        }
+        transports[block]->postReceives(phase, neighbors);
+        for (Neighbor target : neighbors)
+        {
+            HaloPayload payload;
+            payload.converged = flags[block];
+            transports[block]->send(phase, target, std::move(payload));
+        }
+    }
+    for (size_t block = 0; block < localMeshes.size(); ++block)
+    {
+        transports[block]->complete([&](Neighbor source, HaloPayload &payload)
+                                    { neighborFlags[block][int(source)] = payload.converged; });
+    }
+    return neighborFlags;
+}
+
+/*
+Repeat the schedule after its first pass until quality holds globally: a sweep runs all
+task groups again, but a block is only refined in the boxes that still hold bad triangles.
+The global count of bad triangles (owned ones, i.e. inside each block's bbox) is summed
+while the ranks look for the boxes they have to refine. The loop ends as soon as the sum
+is 0, once a sweep did not lower it (triangles refine cannot fix, e.g. at small input
+angles), or after maxSweeps.
+
+Before a sweep, the blocks exchange two flags with their neighbors (see exchangeFlags):
+idle, nothing to refine in this sweep, and converged, idle with all neighbors idle.
+Refinement only adds vertices within r of the refining block, so the halos between two
+converged blocks stay as they are, and both skip their exchanges for the sweep. A rank
+whose blocks and neighbors all converged only takes part in the flag exchanges.
+Phases continue to count from phase, which is left at the next unused one.
+The triangulation of a block is reached through block(b) (e.g. CellStore::acquire out-of-core,
+localMeshes always holds bboxes and neighbors), runBlockPhase runs one phase of the sweep
+with a task group per block (e.g. runPhase). Returns the number of sweeps run.
+*/
+int runSweeps(mpi::communicator &world, std::vector<LocalMesh> &localMeshes, const std::function<LocalMesh &(size_t)> &block,
+              const std::function<void(const std::vector<TaskGroup> &, int)> &runBlockPhase, const std::vector<TaskGroup> &taskGroups,
+              int &phase, int maxSweeps, const std::vector<HaloTransport *> &transports)
+{
+    if (maxSweeps <= 0)
+    {
+        return 0;
+    }
+
+    ConvergenceCheck convergence(world);
+    size_t previous = std::numeric_limits<size_t>::max();
+    int sweep = 0;
+    while (true)
+    {
+        size_t localBad = 0;
+        for (size_t b = 0; b < localMeshes.size(); ++b)
+        {
+            LocalMesh &localMesh = block(b);
+            localBad += localMesh.badTriangles(localMesh.bbox);
+        }
+        convergence.start(localBad);
+
+        // meanwhile: the task groups of the next sweep per block, without the refinements that have nothing to do
+        std::vector<std::vector<TaskGroup>> sweepGroups(taskGroups.size(), std::vector<TaskGroup>(localMeshes.size()));
+        std::vector<bool> idle(localMeshes.size(), true);
+        for (size_t b = 0; b < localMeshes.size(); ++b)
+        {
+            LocalMesh &localMesh = block(b);
+            for (size_t p = 0; p < taskGroups.size(); ++p)
+            {
+                TaskGroup &taskGroup = sweepGroups[p][b] = taskGroups[p];
+                if (taskGroup.refineTask.has_value() &&
+                    localMesh.badTriangles(taskGroup.refineTask.value().bbox(&localMesh.bbox, localMesh.maxCircumradius)) == 0)
+                {
+                    taskGroup.refineTask.reset();
+                }
+                idle[b] = idle[b] && !taskGroup.refineTask.has_value();
+            }
+        }
+
+        size_t bad = convergence.wait();
+        if (world.rank() == 0) std::cout << "Sweep " << sweep << ": " << bad << " bad triangles" << std::endl;
+        if (bad == 0 || bad >= previous || sweep == maxSweeps)
+        {
+            return sweep;
+        }
+        previous = bad;
+
+        // converged blocks drop their sends to and receives from converged neighbors, both sides alike
+        std::vector<std::array<bool, 8>> idleNeighbors = exchangeFlags(localMeshes, idle, phase++, transports);
+        std::vector<bool> converged(localMeshes.size());
+        for (size_t b = 0; b < localMeshes.size(); ++b)
+        {
+            converged[b] = idle[b];
+            for (Neighbor neighbor : allNeighbors)
+            {
+                if (localMeshes[b].neighbors[neighbor].has_value() && !idleNeighbors[b][int(neighbor)])
+                {
+                    converged[b] = false;
+                }
+            }
+        }
+        std::vector<std::array<bool, 8>> convergedNeighbors = exchangeFlags(localMeshes, converged, phase++, transports);
+        for (auto &blockGroups : sweepGroups)
+        {
+            for (size_t b = 0; b < localMeshes.size(); ++b)
+            {
+                if (!converged[b])
+                {
+                    continue;
+                }
+                auto skipped = [&](const Task &task)
+                { return convergedNeighbors[b][int(task.target.value())]; };
+                std::erase_if(blockGroups[b].sendTasks, skipped);
+                std::erase_if(blockGroups[b].receiveTasks, skipped);
+            }
+        }
+
+        sweep += 1;
+        for (auto &blockGroups : sweepGroups)
+        {
+            runBlockPhase(blockGroups, phase++);
+        }
+    }
+}
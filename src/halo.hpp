@@ -0,0 +1,348 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <functional>
+#include <memory_resource>
+#include <unordered_map>
+
+#include "main.hpp"
+
+// HALO EXCHANGE
+
+/*
+Vertices and constraint pieces of one halo message, usually in the sender's phase arena.
+A terrain mesh sends the height of every point along (heights[i] of points[i]), else heights is empty.
+converged is a flag of the sender for runSweeps, carried in the header of the wire format.
+*/
+struct HaloPayload
+{
+    std::pmr::vector<Point2> points;
+    std::pmr::vector<Segment2> segments;
+    std::pmr::vector<double> heights;
+    bool converged = false;
+
+    HaloPayload(std::pmr::memory_resource *resource = std::pmr::get_default_resource()) : points(resource), segments(resource), heights(resource) {}
+};
+
+/*
+Halos of localMesh inside each of sendBboxes (vertices as in pointsInBbox, pieces as in
+constraintsInBbox), bucketed in one pass over the vertices and one over the constraint
+pieces, however many boxes there are. Boxes may overlap (they do at the corners), a vertex
+or piece in several boxes goes into each of their halos.
+*/
+std::pmr::vector<HaloPayload> collectHalos(LocalMesh &localMesh, const std::pmr::vector<Bbox2> &sendBboxes)
+{
+    std::pmr::memory_resource *resource = localMesh.arena.resource();
+    std::pmr::vector<HaloPayload> payloads(resource);
+    for (size_t b = 0; b < sendBboxes.size(); ++b)
+    {
+        payloads.emplace_back(resource);
+    }
+    std::pmr::vector<std::pmr::vector<uint32_t>> indices(sendBboxes.size(), resource);
+
+    VertexSnapshot &snapshot = localMesh.vertices();
+    snapshot.filter(sendBboxes, indices);
+    for (size_t b = 0; b < sendBboxes.size(); ++b)
+    {
+        payloads[b].points.reserve(indices[b].size());
+        for (uint32_t i : indices[b])
+        {
+            payloads[b].points.push_back(Point2(snapshot.x[i], snapshot.y[i]));
+        }
+        if (!localMesh.heights.empty())
+        {
+            payloads[b].heights.reserve(indices[b].size());
+            for (uint32_t i : indices[b])
+            {
+                const Point2 &vertex = *snapshot.handles[i];
+                payloads[b].heights.push_back(localMesh.heights.has(vertex) ? localMesh.heights.at(vertex) : std::nan(""));
+            }
+        }
+    }
+
+    localMesh.arena.segments.clear();
+    localMesh.mesh.getAliveConstraintSegments(localMesh.arena.segments);
+    for (auto &segment : localMesh.arena.segments)
+    {
+        Segment2 piece(*segment->getSrc(), *segment->getTrg());
+        Point2 midpoint = segmentMidpoint(piece);
+        for (size_t b = 0; b < sendBboxes.size(); ++b)
+        {
+            if (sendBboxes[b].isInBox(midpoint))
+            {
+                payloads[b].segments.push_back(piece);
+            }
+        }
+    }
+    return payloads;
+}
+
+/*
+Payload size in bytes as it goes over the wire in packHalo format (same for every transport,
+so the numbers of different transports are comparable).
+*/
+size_t haloBytes(const HaloPayload &payload)
+{
+    return sizeof(double) * (3 + 2 * payload.points.size() + 4 * payload.segments.size() + payload.heights.size());
+}
+
+/*
+Write the flat wire format of payload to out (haloBytes(payload) bytes), returns the number of doubles:
+    numPoints, numSegments, converged, x0, y0, x1, y1, ..., segments as in flattenSegments[, z0, z1, ... of a terrain]
+*/
+size_t packHalo(const HaloPayload &payload, double *out)
+{
+    double *next = out;
+    *next++ = double(payload.points.size());
+    *next++ = double(payload.segments.size());
+    *next++ = payload.converged ? 1.0 : 0.0;
+    for (auto &point : payload.points)
+    {
+        *next++ = point.x();
+        *next++ = point.y();
+    }
+    for (auto &segment : payload.segments)
+    {
+        *next++ = segment.getSrc().x();
+        *next++ = segment.getSrc().y();
+        *next++ = segment.getTrg().x();
+        *next++ = segment.getTrg().y();
+    }
+    next = std::copy(payload.heights.begin(), payload.heights.end(), next);
+    return size_t(next - out);
+}
+
+/*
+Append the flat wire format of payload to out.
+*/
+void packHalo(const HaloPayload &payload, std::vector<double> &out)
+{
+    size_t offset = out.size();
+    out.resize(offset + haloBytes(payload) / sizeof(double));
+    packHalo(payload, out.data() + offset);
+}
+
+/*
+Read a payload written by packHalo from count doubles at data, allocated from resource.
+An empty or malformed buffer gives an empty payload.
+*/
+HaloPayload unpackHalo(const double *data, size_t count, std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+{
+    HaloPayload payload(resource);
+    if (count < 3)
+    {
+        return payload;
+    }
+    size_t numPoints = size_t(data[0]), numSegments = size_t(data[1]);
+    bool withHeights = numPoints > 0 && count == 3 + 3 * numPoints + 4 * numSegments;
+    if (count != 3 + 2 * numPoints + 4 * numSegments && !withHeights)
+    {
+        return payload;
+    }
+    payload.converged = data[2] != 0;
+    const double *point = data + 3;
+    payload.points.reserve(numPoints);
+    for (size_t i = 0; i < numPoints; ++i, point += 2)
+    {
+        payload.points.push_back(Point2(point[0], point[1]));
+    }
+    payload.segments.reserve(numSegments);
+    for (size_t i = 0; i < numSegments; ++i, point += 4)
+    {
+        payload.segments.push_back(Segment2(Point2(point[0], point[1]), Point2(point[2], point[3])));
+    }
+    if (withHeights)
+    {
+        payload.heights.assign(point, point + numPoints);
+    }
+    return payload;
+}
+
+/*
+Time and volume of the halo exchanges of one transport on one rank.
+*/
+struct HaloStats
+{
+    size_t messages = 0;
+    size_t bytes = 0;
+    double milliseconds = 0;
+};
+
+/*
+Moves the halos of one phase between neighboring local meshes.
+A phase is postReceives (before refinement, so receives can be posted early),
+one send per send task (the payload is moved in), then complete, which hands every
+expected payload to deliver as it arrives and returns once all sends of the phase are done.
+*/
+class HaloTransport
+{
+public:
+    HaloStats stats;
+
+    virtual ~HaloTransport() {}
+
+    virtual const char *name() const = 0;
+
+    virtual void postReceives(int phase, const std::vector<Neighbor> &sources) = 0;
+
+    virtual void send(int phase, Neighbor target, HaloPayload payload) = 0;
+
+    virtual void complete(const std::function<void(Neighbor, HaloPayload &)> &deliver) = 0;
+};
+
+/*
+Accumulates the wall time of a transport call into stats on destruction.
+*/
+class HaloTimer
+{
+private:
+    HaloStats &stats;
+    std::chrono::high_resolution_clock::time_point start;
+
+public:
+    HaloTimer(HaloStats &stats) : stats(stats), start(std::chrono::high_resolution_clock::now()) {}
+
+    ~HaloTimer()
+    {
+        auto end = std::chrono::high_resolution_clock::now();
+        stats.milliseconds += std::chrono::duration<double, std::milli>(end - start).count();
+    }
+};
+
+/*
+What a started phase still needs to finish: where halos come from, the boxes they
+replace, and (only if asked to keep them) the halos that were sent.
+Lives in the phase arena, so it must be gone before the next startPhase.
+*/
+struct PhaseState
+{
+    std::vector<Neighbor> sources;
+    std::pmr::unordered_map<Neighbor, Bbox2> receiveBoxes;
+    std::pmr::vector<std::pair<Neighbor, HaloPayload>> outgoing;
+
+    PhaseState(std::pmr::memory_resource *resource = std::pmr::get_default_resource()) : receiveBoxes(resource), outgoing(resource) {}
+};
+
+/*
+First half of a phase on localMesh: post the receives, refine and send the halos.
+Sent payloads are moved into the transport unless keepOutgoing is set.
+Everything of the previous phase in the arena of localMesh is released here.
+*/
+PhaseState startPhase(LocalMesh &localMesh, const TaskGroup &taskGroup, int phase, HaloTransport &transport, bool keepOutgoing = false)
+{
+    localMesh.arena.reset();
+    PhaseState state(localMesh.arena.resource());
+
+    // post all async receives (meshes on the edges have fewer neighbors)
+    for (auto &task : taskGroup.receiveTasks)
+    {
+        if (localMesh.neighbors[task.target.value()].has_value())
+        {
+            state.sources.push_back(task.target.value());
+            state.receiveBoxes[task.target.value()] = task.bbox(&localMesh.bbox, localMesh.maxCircumradius);
+        }
+    }
+    transport.postReceives(phase, state.sources);
+
+    // do refinement (or smoothing), if any
+    if (taskGroup.refineTask.has_value())
+    {
+        Bbox2 box = taskGroup.refineTask.value().bbox(&localMesh.bbox, localMesh.maxCircumradius);
+        if (taskGroup.refineTask.value().operation == Operation::Smooth)
+        {
+            localMesh.smoothBbox(box);
+        }
+        else
+        {
+            localMesh.refineBbox(box);
+        }
+    }
+
+    // collect the halos of all send tasks in one pass, then post all async sends
+    std::pmr::vector<Neighbor> targets(localMesh.arena.resource());
+    std::pmr::vector<Bbox2> sendBboxes(localMesh.arena.resource());
+    for (auto &task : taskGroup.sendTasks)
+    {
+        if (localMesh.neighbors[task.target.value()].has_value())
+        {
+            targets.push_back(task.target.value());
+            sendBboxes.push_back(task.bbox(&localMesh.bbox, localMesh.maxCircumradius));
+        }
+    }
+    std::pmr::vector<HaloPayload> halos = collectHalos(localMesh, sendBboxes);
+    for (size_t i = 0; i < targets.size(); ++i)
+    {
+        state.outgoing.emplace_back(targets[i], std::move(halos[i]));
+    }
+    for (auto &[target, payload] : state.outgoing)
+    {
+        if (keepOutgoing)
+        {
+            transport.send(phase, target, payload);
+        }
+        else
+        {
+            transport.send(phase, target, std::move(payload));
+        }
+    }
+    return state;
+}
+
+/*
+Second half of a phase: apply the incoming halos as they arrive and wait for the sends to complete.
+*/
+void finishPhase(LocalMesh &localMesh, PhaseState &state, HaloTransport &transport)
+{
+    transport.complete([&](Neighbor source, HaloPayload &payload)
+                       { localMesh.updateBbox(state.receiveBoxes[source], payload.points, payload.segments, payload.heights); });
+}
+
+/*
+Run one phase of the schedule on localMesh. The same halos are then pushed through every
+transport in shadows (results dropped) to time them against transport on identical data.
+*/
+void runPhase(LocalMesh &localMesh, const TaskGroup &taskGroup, int phase, HaloTransport &transport,
+              const std::vector<HaloTransport *> &shadows = {})
+{
+    PhaseState state = startPhase(localMesh, taskGroup, phase, transport, !shadows.empty());
+    finishPhase(localMesh, state, transport);
+
+    for (HaloTransport *shadow : shadows)
+    {
+        shadow->postReceives(phase, state.sources);
+        for (auto &[target, payload] : state.outgoing)
+        {
+            shadow->send(phase, target, payload);
+        }
+        shadow->complete([](Neighbor, HaloPayload &) {});
+    }
+}
+
+/*
+Run one phase on all blocks of this rank, block b with taskGroups[b] and transports[b].
+A block may wait for the halo of another block of the same rank, so every block starts
+(refines and sends) before any of them finishes. With a single block this is the phase
+above, shadows are only timed in that case.
+*/
+void runPhase(std::vector<LocalMesh> &localMeshes, const std::vector<TaskGroup> &taskGroups, int phase,
+              const std::vector<HaloTransport *> &transports, const std::vector<HaloTransport *> &shadows = {})
+{
+    if (localMeshes.size() == 1)
+    {
+        runPhase(localMeshes[0], taskGroups[0], phase, *transports[0], shadows);
+        return;
+    }
+
+    std::vector<std::optional<PhaseState>> states(localMeshes.size());
+    for (size_t block = 0; block < localMeshes.size(); ++block)
+    {
+        states[block].emplace(startPhase(localMeshes[block], taskGroups[block], phase, *transports[block]));
+    }
+    for (size_t block = 0; block < localMeshes.size(); ++block)
+    {
+        finishPhase(localMeshes[block], *states[block], *transports[block]);
+        // the state lives in the block's arena, drop it before the next reset
+        states[block].reset();
+    }
+}
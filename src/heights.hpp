@@ -0,0 +1,222 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <unordered_map>
+
+#include <Fade_2D.h>
+
+using namespace GEOM_FADE2D;
+
+// TERRAIN HEIGHTS
+
+/*
+Heights of the vertices of a terrain mesh. The 2D build of Fade has no z, so a vertex's
+custom index is its slot in values (-1, the default, for a vertex without a height yet,
+e.g. a Steiner point of refine). Points get their slot before they are inserted and bind
+copies it to the vertex handles (bulkInsert inserts coordinates only). Removed vertices
+leave their slot behind until compact. An empty table means the mesh carries no heights.
+*/
+class HeightTable
+{
+public:
+    std::vector<double> values;
+
+    bool empty() const
+    {
+        return values.empty();
+    }
+
+    bool has(const Point2 &point) const
+    {
+        int slot = point.getCustomIndex();
+        return slot >= 0 && size_t(slot) < values.size();
+    }
+
+    double at(const Point2 &point) const
+    {
+        return values[point.getCustomIndex()];
+    }
+
+    /*
+    Give point a new slot holding height.
+    */
+    void assign(Point2 &point, double height)
+    {
+        point.setCustomIndex(int(values.size()));
+        values.push_back(height);
+    }
+
+    /*
+    Set the height of a vertex, in its own slot if it has one.
+    */
+    void set(Point2 &vertex, double height)
+    {
+        if (has(vertex))
+        {
+            values[vertex.getCustomIndex()] = height;
+        }
+        else
+        {
+            assign(vertex, height);
+        }
+    }
+
+    /*
+    Copy the slots of points (as reordered by bulkInsert) to their handles. A point that
+    coincided with an existing vertex keeps that vertex's height.
+    */
+    template <class Points, class Handles>
+    void bind(const Points &points, const Handles &handles)
+    {
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            if (handles[i] != nullptr && !has(*handles[i]) && has(points[i]))
+            {
+                handles[i]->setCustomIndex(points[i].getCustomIndex());
+            }
+        }
+    }
+
+    /*
+    x, y, z of every vertex of mesh (NaN for a vertex without height), the form in which the
+    heights travel and are stored: custom indices don't survive Fade's save and load, nor a
+    re-insertion of the vertices.
+    */
+    std::vector<double> exportVertices(Fade_2D &mesh) const
+    {
+        std::vector<Point2 *> vertices;
+        mesh.getVertexPointers(vertices);
+        std::vector<double> xyz;
+        xyz.reserve(3 * vertices.size());
+        for (auto &vertex : vertices)
+        {
+            xyz.insert(xyz.end(), {vertex->x(), vertex->y(), has(*vertex) ? at(*vertex) : std::nan("")});
+        }
+        return xyz;
+    }
+
+    /*
+    Rebuild the table for the vertices of mesh from exportVertices data, matched by coordinates.
+    */
+    void importVertices(Fade_2D &mesh, const std::vector<double> &xyz)
+    {
+        values.clear();
+        if (xyz.empty())
+        {
+            return;
+        }
+        std::unordered_map<double, std::unordered_map<double, double>> heightAt;
+        for (size_t i = 0; i + 2 < xyz.size(); i += 3)
+        {
+            heightAt[xyz[i]][xyz[i + 1]] = xyz[i + 2];
+        }
+        std::vector<Point2 *> vertices;
+        mesh.getVertexPointers(vertices);
+        values.reserve(vertices.size());
+        for (auto &vertex : vertices)
+        {
+            vertex->setCustomIndex(-1);
+            auto column = heightAt.find(vertex->x());
+            if (column == heightAt.end())
+            {
+                continue;
+            }
+            auto height = column->second.find(vertex->y());
+            if (height != column->second.end() && !std::isnan(height->second))
+            {
+                assign(*vertex, height->second);
+            }
+        }
+    }
+
+    /*
+    Drop the slots of removed vertices once they are the majority (re-slots all vertices).
+    */
+    void compact(Fade_2D &mesh)
+    {
+        if (values.size() < 2 * size_t(mesh.numberOfPoints()) + 1024)
+        {
+            return;
+        }
+        std::vector<Point2 *> vertices;
+        mesh.getVertexPointers(vertices);
+        std::vector<double> compacted;
+        compacted.reserve(vertices.size());
+        for (auto &vertex : vertices)
+        {
+            if (has(*vertex))
+            {
+                double height = at(*vertex);
+                vertex->setCustomIndex(int(compacted.size()));
+                compacted.push_back(height);
+            }
+        }
+        values.swap(compacted);
+    }
+};
+
+/*
+Triangulation of the input terrain samples with their own heights: the surface refinement
+measures against. Kept apart from the mesh, whose vertices include interpolated Steiner points.
+*/
+struct TerrainSurface
+{
+    Fade_2D mesh;
+    HeightTable heights;
+};
+
+/*
+Height at p by linear interpolation over the plane through the corners of triangle
+(barycentric weights, p may lie outside, then the plane is extrapolated).
+All corners must have heights.
+*/
+double interpolateHeight(const HeightTable &heights, Triangle2 *triangle, const Point2 &p)
+{
+    const Point2 &a = *triangle->getCorner(0), &b = *triangle->getCorner(1), &c = *triangle->getCorner(2);
+    double area = (b.x() - a.x()) * (c.y() - a.y()) - (c.x() - a.x()) * (b.y() - a.y());
+    if (area == 0)
+    {
+        return (heights.at(a) + heights.at(b) + heights.at(c)) / 3;
+    }
+    double wa = ((b.x() - p.x()) * (c.y() - p.y()) - (c.x() - p.x()) * (b.y() - p.y())) / area;
+    double wb = ((c.x() - p.x()) * (a.y() - p.y()) - (a.x() - p.x()) * (c.y() - p.y())) / area;
+    return wa * heights.at(a) + wb * heights.at(b) + (1 - wa - wb) * heights.at(c);
+}
+
+/*
+True if all corners of triangle have heights.
+*/
+bool hasHeights(const HeightTable &heights, Triangle2 *triangle)
+{
+    return heights.has(*triangle->getCorner(0)) && heights.has(*triangle->getCorner(1)) && heights.has(*triangle->getCorner(2));
+}
+
+/*
+Read terrain samples as text lines "x y z" (the usual ASCII export of LiDAR point clouds)
+into points, each with its slot in heights. Lines that don't parse are skipped.
+*/
+bool readTerrain(const std::string &path, std::vector<Point2> &points, HeightTable &heights)
+{
+    std::ifstream stream(path);
+    if (!stream.is_open())
+    {
+        std::cout << "Can't read terrain " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        std::istringstream fields(line);
+        double x, y, z;
+        if (fields >> x >> y >> z)
+        {
+            points.push_back(Point2(x, y));
+            heights.assign(points.back(), z);
+        }
+    }
+    return true;
+}
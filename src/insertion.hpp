@@ -0,0 +1,283 @@
+#pragma once
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <memory_resource>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <Fade_2D.h>
+
+using namespace GEOM_FADE2D;
+
+// PRESORTED INSERTION
+
+/*
+Order in which bulk inserted points are handed to Fade_2D::insert.
+Fade walks from the last inserted point to locate the next one, so spatially
+coherent input keeps the walk short and the touched triangles in cache.
+*/
+enum class InsertionOrder
+{
+    Fade,   // as received
+    Morton, // sorted along the Morton curve
+    Brio    // biased randomized insertion order: random rounds of doubling size, each Morton sorted
+};
+
+InsertionOrder parseInsertionOrder(const std::string &name)
+{
+    if (name == "fade") return InsertionOrder::Fade;
+    if (name == "brio") return InsertionOrder::Brio;
+    return InsertionOrder::Morton;
+}
+
+/*
+Accumulated cost of the bulk inserts of one mesh, to compare the orders on the same run.
+cacheMisses is -1 if hardware counters are not available (e.g. perf_event_paranoid).
+*/
+struct InsertionStats
+{
+    size_t calls = 0;
+    size_t points = 0;
+    double sortMilliseconds = 0;
+    double insertMilliseconds = 0;
+    long long cacheMisses = 0;
+};
+
+/*
+Hardware cache miss counter of the calling thread (Linux perf events).
+*/
+class CacheMissCounter
+{
+private:
+    int fd = -1;
+
+public:
+    CacheMissCounter()
+    {
+        perf_event_attr attr = {};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    ~CacheMissCounter()
+    {
+        if (fd >= 0) close(fd);
+    }
+
+    bool available() const { return fd >= 0; }
+
+    void start()
+    {
+        if (fd < 0) return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    long long stop()
+    {
+        long long count = -1;
+        if (fd < 0) return count;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != ssize_t(sizeof(count))) count = -1;
+        return count;
+    }
+};
+
+/*
+32 bit Morton keys (16 bits per axis, plenty for insertion locality) of n points given as SoA.
+The AVX2 path quantizes and interleaves 4 points per iteration, the scalar loop does the rest.
+*/
+void computeInsertionKeys(const double *x, const double *y, size_t n, double minX, double minY, double scale, uint32_t *keys)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256d vMinX = _mm256_set1_pd(minX), vMinY = _mm256_set1_pd(minY);
+    const __m256d vScale = _mm256_set1_pd(scale);
+    const __m256d vZero = _mm256_setzero_pd(), vMax = _mm256_set1_pd(65535.0);
+    auto spread4 = [](__m128i v)
+    {
+        v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v, 8)), _mm_set1_epi32(0x00FF00FF));
+        v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v, 4)), _mm_set1_epi32(0x0F0F0F0F));
+        v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v, 2)), _mm_set1_epi32(0x33333333));
+        v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v, 1)), _mm_set1_epi32(0x55555555));
+        return v;
+    };
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d qx = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(x + i), vMinX), vScale);
+        __m256d qy = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(y + i), vMinY), vScale);
+        qx = _mm256_min_pd(_mm256_max_pd(qx, vZero), vMax);
+        qy = _mm256_min_pd(_mm256_max_pd(qy, vZero), vMax);
+        __m128i ix = spread4(_mm256_cvttpd_epi32(qx));
+        __m128i iy = spread4(_mm256_cvttpd_epi32(qy));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(keys + i), _mm_or_si128(ix, _mm_slli_epi32(iy, 1)));
+    }
+#endif
+    auto spread = [](uint32_t v)
+    {
+        v = (v | (v << 8)) & 0x00FF00FF;
+        v = (v | (v << 4)) & 0x0F0F0F0F;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+    for (; i < n; ++i)
+    {
+        double qx = std::min(std::max((x[i] - minX) * scale, 0.0), 65535.0);
+        double qy = std::min(std::max((y[i] - minY) * scale, 0.0), 65535.0);
+        keys[i] = spread(uint32_t(qx)) | (spread(uint32_t(qy)) << 1);
+    }
+}
+
+/*
+LSD radix sort of the n (key << 32 | index) entries on the key, 8 bits per pass,
+using buffer (n entries) as the other half of the ping-pong. Passes in which all keys
+share the same digit are skipped.
+*/
+void radixSortByKey(uint64_t *entries, size_t n, uint64_t *buffer)
+{
+    uint64_t *from = entries, *to = buffer;
+    for (int shift = 32; shift < 64; shift += 8)
+    {
+        size_t counts[257] = {};
+        for (size_t i = 0; i < n; ++i)
+        {
+            ++counts[((from[i] >> shift) & 0xFF) + 1];
+        }
+        if (n == 0 || counts[((from[0] >> shift) & 0xFF) + 1] == n)
+        {
+            continue;
+        }
+        for (int digit = 0; digit < 256; ++digit)
+        {
+            counts[digit + 1] += counts[digit];
+        }
+        for (size_t i = 0; i < n; ++i)
+        {
+            to[counts[(from[i] >> shift) & 0xFF]++] = from[i];
+        }
+        std::swap(from, to);
+    }
+    if (from != entries)
+    {
+        std::copy(from, from + n, entries);
+    }
+}
+
+/*
+Reorder points for insertion. Morton sorts all points, Brio splits a random permutation
+into rounds of doubling size (..., n/4, n/2) and Morton sorts each round on its own.
+Temporaries are allocated from scratch, points' own allocator is never used (the points
+may live in another thread's arena).
+*/
+template <class Points>
+void presortPoints(Points &points, InsertionOrder order, std::pmr::memory_resource *scratch)
+{
+    size_t n = points.size();
+    if (order == InsertionOrder::Fade || n < 2)
+    {
+        return;
+    }
+
+    std::pmr::vector<double> x(n, scratch), y(n, scratch);
+    double minX = points[0].x(), minY = points[0].y(), maxX = minX, maxY = minY;
+    for (size_t i = 0; i < n; ++i)
+    {
+        x[i] = points[i].x();
+        y[i] = points[i].y();
+        minX = std::min(minX, x[i]);
+        minY = std::min(minY, y[i]);
+        maxX = std::max(maxX, x[i]);
+        maxY = std::max(maxY, y[i]);
+    }
+    double range = std::max(std::max(maxX - minX, maxY - minY), 1e-300);
+    std::pmr::vector<uint32_t> keys(n, scratch);
+    computeInsertionKeys(x.data(), y.data(), n, minX, minY, 65535.0 / range, keys.data());
+
+    std::pmr::vector<uint64_t> entries(n, scratch);
+    for (size_t i = 0; i < n; ++i)
+    {
+        entries[i] = (uint64_t(keys[i]) << 32) | i;
+    }
+
+    std::pmr::vector<uint64_t> buffer(n, scratch);
+    if (order == InsertionOrder::Brio)
+    {
+        // fixed seed: the same input is always inserted in the same order
+        std::mt19937_64 random(42);
+        std::shuffle(entries.begin(), entries.end(), random);
+        for (size_t end = n, begin; end > 0; end = begin)
+        {
+            begin = end / 2 < 64 ? 0 : end / 2;
+            radixSortByKey(entries.data() + begin, end - begin, buffer.data());
+        }
+    }
+    else
+    {
+        radixSortByKey(entries.data(), n, buffer.data());
+    }
+
+    std::pmr::vector<Point2> reordered(scratch);
+    reordered.reserve(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        reordered.push_back(points[entries[i] & 0xFFFFFFFFull]);
+    }
+    std::copy(reordered.begin(), reordered.end(), points.begin());
+}
+
+/*
+Bulk insert points into mesh in the given order, accumulating the sort and insertion
+time and the cache misses of the insert into stats (if given).
+The points are reordered in place, temporaries come from scratch (the heap if not given).
+Returns the vertex handle of every (reordered) point, allocated from scratch.
+*/
+template <class Points>
+std::pmr::vector<Point2 *> bulkInsert(Fade_2D &mesh, Points &points, InsertionOrder order, InsertionStats *stats = nullptr,
+                std::pmr::memory_resource *scratch = std::pmr::new_delete_resource())
+{
+    static thread_local CacheMissCounter counter;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    presortPoints(points, order, scratch);
+    std::pmr::vector<double> coordinates(2 * points.size(), scratch);
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        coordinates[2 * i] = points[i].x();
+        coordinates[2 * i + 1] = points[i].y();
+    }
+    std::pmr::vector<Point2 *> handles(points.size(), scratch);
+    auto sorted = std::chrono::high_resolution_clock::now();
+
+    counter.start();
+    if (!points.empty())
+    {
+        mesh.insert(int(points.size()), coordinates.data(), handles.data());
+    }
+    long long misses = counter.stop();
+    auto inserted = std::chrono::high_resolution_clock::now();
+
+    if (stats != nullptr)
+    {
+        stats->calls += 1;
+        stats->points += points.size();
+        stats->sortMilliseconds += std::chrono::duration<double, std::milli>(sorted - start).count();
+        stats->insertMilliseconds += std::chrono::duration<double, std::milli>(inserted - sorted).count();
+        stats->cacheMisses = (misses < 0 || stats->cacheMisses < 0) ? -1 : stats->cacheMisses + misses;
+    }
+    return handles;
+}
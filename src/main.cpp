@@ -1,4 +1,12 @@
 #include "main.hpp"
+#include "checkpoint.hpp"
+#include "convergence.hpp"
+#include "output.hpp"
+#include "transport.hpp"
+#include "blocks.hpp"
+#include "outofcore.hpp"
+#include "quality.hpp"
+#include "seams.hpp"
 
 int main(int argc, char** argv) {
     // initialize MPI
@@ -7,109 +15,408 @@ int main(int argc, char** argv) {
 
     // important variables
     Timer timer;
-    LocalMesh localMesh;
     RuntimeParameters runtimeParameters(argc, argv);
-    std::vector<MeshUpdate> incomingUpdates;
-    std::vector<MeshUpdate> outgoingUpdates;
+    if (runtimeParameters.help) {
+        if (world.rank() == 0) std::cout << usageText;
+        return 0;
+    }
+    int blocksPerRank = runtimeParameters.blocksPerRank;
+    std::vector<LocalMesh> localMeshes(blocksPerRank); // the blocks of this rank, one unless over-decomposed, built in place
+    BlockRouting routing;
     std::vector<TaskGroup> taskGroups = initializeTaskGroups();
+    localMeshes.front().insertionOrder = parseInsertionOrder(runtimeParameters.insertionOrder);
+
+    // a restart reads <checkpoint dir>/latest
+    if (runtimeParameters.restart && runtimeParameters.checkpointDir.empty()) {
+        if (world.rank() == 0) std::cout << "--restart needs --checkpoint <dir>" << std::endl;
+        world.abort(1);
+    }
+    // checkpoints hold one block per rank
+    if (blocksPerRank > 1 && (runtimeParameters.restart || !runtimeParameters.checkpointDir.empty())) {
+        if (world.rank() == 0) std::cout << "Checkpoints need --blocks-per-rank 1" << std::endl;
+        world.abort(1);
+    }
+    // the block transports tell remote halos apart by slot in the tag
+    if (blocksPerRank > 1 && !blockTagsFit(world, blocksPerRank)) {
+        if (world.rank() == 0) std::cout << "--blocks-per-rank " << blocksPerRank << " exceeds the MPI tag range" << std::endl;
+        world.abort(1);
+    }
+
+    // out-of-core streams the blocks of a rank through memory, one phase at a time, from a saved mesh (see below)
+    bool outOfCore = runtimeParameters.residentCells > 0;
+    if (outOfCore && (runtimeParameters.restart || !runtimeParameters.checkpointDir.empty())) {
+        if (world.rank() == 0) std::cout << "--resident-cells can't be combined with --checkpoint or --restart" << std::endl;
+        world.abort(1);
+    }
+    // terrain heights travel with the flat halo payloads and are written by the curve-ordered output only
+    bool terrain = !runtimeParameters.terrainPath.empty();
+    if (terrain && blocksPerRank == 1 && runtimeParameters.haloTransport == "boost") {
+        if (world.rank() == 0) std::cout << "--terrain can't be combined with --halo-transport boost" << std::endl;
+        world.abort(1);
+    }
+    // a saved mesh holds no heights
+    if (terrain && !runtimeParameters.loadMeshPath.empty()) {
+        if (world.rank() == 0) std::cout << "--terrain can't be combined with --load-mesh" << std::endl;
+        world.abort(1);
+    }
+    CellStore cellStore(localMeshes, runtimeParameters.spillDir, world.rank(), world.size(), runtimeParameters.residentCells);
 
     // start timer for overall duration
     if (world.rank() == 0) timer.start("Total Time");
 
+    // on restart, resume after the last complete checkpoint and skip load, pre-refinement and scatter
+    int lastPhase = -1;
+    if (runtimeParameters.restart) {
+        lastPhase = restoreCheckpoint(world, runtimeParameters.checkpointDir, localMeshes.front());
+    }
+
+    // node layout for the hierarchical split, only usable if every node runs the same number of ranks
+    std::vector<std::vector<int>> nodes;
+    if (runtimeParameters.hierarchical && lastPhase < 0) {
+        nodes = nodeRanks(world);
+        for (auto& node : nodes) {
+            if (node.size() != nodes.front().size()) {
+                if (world.rank() == 0) std::cout << "Nodes run different numbers of ranks, using a flat split" << std::endl;
+                nodes.clear();
+                break;
+            }
+        }
+    }
+
+    // a saved mesh with blocksPerRank blocks per rank (and no boundary, the file holds none) is mapped
+    // by every rank itself, block by block, without the sequential load and scatter
+    bool mappedBlocks = false;
+    if (lastPhase < 0 && !runtimeParameters.loadMeshPath.empty() && !runtimeParameters.hierarchical &&
+        runtimeParameters.boundaryPath.empty()) {
+        uint64_t numBlocks = 0;
+        if (world.rank() == 0) {
+            MappedMesh mapped;
+            if (mapped.openFile(runtimeParameters.loadMeshPath)) {
+                numBlocks = mapped.header.numBlocks;
+                routing = assignBlocks(mapped.blockGrid(), world.size(), blocksPerRank);
+            }
+        }
+        mpi::broadcast(world, numBlocks, 0);
+        mappedBlocks = numBlocks == uint64_t(runtimeParameters.numBlocks(world.size()));
+        if (mappedBlocks) mpi::broadcast(world, routing, 0);
+    }
+    // the sequential load would hold the whole input on rank 0
+    if (outOfCore && !mappedBlocks) {
+        if (world.rank() == 0) {
+            std::cout << "--resident-cells needs --load-mesh with a block table of " << runtimeParameters.numBlocks(world.size())
+                      << " blocks (see --save-mesh), and no --boundary or --hierarchical" << std::endl;
+        }
+        world.abort(1);
+    }
+
     // load and preprocess mesh sequentially, scatter localMeshes to workers
-    if (world.rank() == 0) {
+    if (lastPhase >= 0) {
+        if (world.rank() == 0) std::cout << "Restarting after phase " << lastPhase << std::endl;
+    } else if (mappedBlocks) {
+        // the halo width of all blocks first, a spilled block is written with it
+        std::vector<size_t> blocksOfRank = distributeBlocks(routing, world.size())[world.rank()];
+        double maxCircumradius = 0;
+        for (size_t b : blocksOfRank) {
+            MappedMesh mapped;
+            if (!mapped.openBlock(runtimeParameters.loadMeshPath, b)) {
+                world.abort(1);
+            }
+            maxCircumradius = std::max(maxCircumradius, mapped.maxCircumradius());
+        }
+        maxCircumradius = mpi::all_reduce(world, maxCircumradius, mpi::maximum<double>());
+        // map the blocks one at a time, out-of-core spilling beyond the resident ones
+        for (int slot = 0; slot < blocksPerRank; ++slot) {
+            LocalMesh& localMesh = localMeshes[slot];
+            localMesh.insertionOrder = parseInsertionOrder(runtimeParameters.insertionOrder);
+            if (!localMesh.loadFromBinary(runtimeParameters.loadMeshPath, blocksOfRank[slot])) {
+                world.abort(1);
+            }
+            localMesh.maxCircumradius = maxCircumradius;
+            routeNeighbors(localMesh, routing);
+            if (outOfCore && !cellStore.admit(slot)) {
+                world.abort(1);
+            }
+        }
+        if (world.rank() == 0) std::cout << "Mapped " << runtimeParameters.numBlocks(world.size()) << " blocks of " << runtimeParameters.loadMeshPath << std::endl;
+    } else if (world.rank() == 0) {
         // load mesh file and perform initial sequential refinement
         GlobalMesh globalMesh = GlobalMesh(runtimeParameters);
+        if (!runtimeParameters.loadMeshPath.empty()) {
+            if (!globalMesh.loadFromBinary(runtimeParameters.loadMeshPath)) {
+                world.abort(1);
+            }
+        } else if (!runtimeParameters.inFilePath.empty() && !globalMesh.loadPoints()) {
+            world.abort(1);
+        }
+        if (terrain && !globalMesh.loadTerrain(runtimeParameters.terrainPath)) {
+            world.abort(1);
+        }
+        if (!runtimeParameters.boundaryPath.empty() && !globalMesh.loadBoundary(runtimeParameters.boundaryPath)) {
+            world.abort(1);
+        }
         globalMesh.refineMesh();
 
-        // split globalMesh into localMeshes and send them to threads
-        std::vector<LocalMesh> localMeshes = globalMesh.splitMesh(world.size(), false);
+        // lay out blocksPerRank blocks per rank and deal them along the curve, per node if hierarchical
+        globalMesh.layoutBlocks(runtimeParameters.numBlocks(world.size()), int(std::max<size_t>(nodes.size(), 1)));
+        if (!runtimeParameters.saveMeshPath.empty() && !globalMesh.saveToBinary(runtimeParameters.saveMeshPath, true)) {
+            world.abort(1);
+        }
+        if (globalMesh.nodeCols * globalMesh.nodeRows > 1) {
+            routing = assignBlocksToNodes(globalMesh.grid, globalMesh.nodeCols, globalMesh.nodeRows, nodes, blocksPerRank);
+        } else {
+            routing = assignBlocks(globalMesh.grid, world.size(), blocksPerRank);
+        }
+        std::vector<std::vector<size_t>> blocksOfRank = distributeBlocks(routing, world.size());
 
-        // disseminates local meshes
-        mpi::scatter(world, localMeshes, localMesh, 0);
+        // build the blocks in place one at a time and send them slot by slot, the order the ranks receive in
+        for (int slot = 0; slot < blocksPerRank; ++slot) {
+            for (int rank = 0; rank < world.size(); ++rank) {
+                if (rank == 0) {
+                    globalMesh.fillBlock(blocksOfRank[rank][slot], localMeshes[slot]);
+                    routeNeighbors(localMeshes[slot], routing);
+                } else {
+                    LocalMesh outgoing;
+                    globalMesh.fillBlock(blocksOfRank[rank][slot], outgoing);
+                    routeNeighbors(outgoing, routing);
+                    world.send(rank, slot, outgoing);
+                }
+            }
+        }
     } else {
-        // receive local mesh
-        mpi::scatter(world, localMesh, 0);
+        // receive local meshes one by one
+        for (int slot = 0; slot < blocksPerRank; ++slot) {
+            world.recv(0, slot, localMeshes[slot]);
+        }
+    }
+    if (blocksPerRank > 1 && !mappedBlocks) {
+        mpi::broadcast(world, routing, 0);
     }
 
-    // Start of Computation
-    if (world.rank() == 0) timer.start("Parallel Compute Region");
+    // scratch memory of the phases, insertion order of the received blocks
+    for (auto& localMesh : localMeshes) {
+        localMesh.arena = PhaseArena(runtimeParameters.arenaBytes);
+        localMesh.insertionOrder = parseInsertionOrder(runtimeParameters.insertionOrder);
+        localMesh.heightTolerance = runtimeParameters.heightTolerance;
+        localMesh.smoothingIterations = runtimeParameters.smoothingIterations;
+    }
 
-    // loop through each taskGroup (phase)
-    for (auto& taskGroup : taskGroups) {
-        // post all async receives
-        for (auto& task : taskGroup.receiveTasks) {
-            // check if that neighbor exists first (meshes on the edges has fewer neighbors)
-            std::optional<size_t> requestSource = localMesh.neighbors[task.target.value()];
-            if (requestSource.has_value()) {
-                SerializableMesh* buffer = new SerializableMesh();
-                mpi::request request = world.irecv(requestSource.value(), 0, buffer);
-                MeshUpdate update{request, task.bbox(&localMesh.bbox, localMesh.maxCircumradius), buffer};
-                incomingUpdates.push_back(update);
+    // neighbor topology is fixed from here on, set up the halo transports once
+    // with one block per rank: the selected transport moves the halos, the others only repeat the exchange for timing
+    // with several: a block transport per block, moving halos between blocks of the same rank in memory
+    std::vector<std::unique_ptr<HaloTransport>> transports;
+    std::vector<HaloTransport*> shadows;
+    std::unique_ptr<BlockExchange> blockExchange;
+    if (blocksPerRank > 1) {
+        blockExchange = std::make_unique<BlockExchange>(world, localMeshes.size());
+        transports = makeBlockTransports(world, localMeshes, routing, *blockExchange);
+    } else {
+        LocalMesh& localMesh = localMeshes.front();
+        transports.push_back(makeHaloTransport(runtimeParameters.haloTransport, world, localMesh, runtimeParameters));
+        if (!transports.front()) {
+            if (world.rank() == 0) std::cout << "Unknown halo transport " << runtimeParameters.haloTransport << std::endl;
+            world.abort(1);
+        }
+        for (std::string name : {"graph", "boost", "raw", "shm"}) {
+            if (runtimeParameters.haloBenchmark && name != runtimeParameters.haloTransport) {
+                shadows.push_back(transports.emplace_back(makeHaloTransport(name, world, localMesh, runtimeParameters)).get());
             }
         }
+    }
+    std::vector<HaloTransport*> blockTransports;
+    for (size_t block = 0; block < localMeshes.size(); ++block) {
+        blockTransports.push_back(transports[block].get());
+    }
 
-        // do refinement, if any
-        if (taskGroup.refineTask.has_value()) {
-            localMesh.refineBbox(taskGroup.refineTask.value().bbox(&localMesh.bbox, localMesh.maxCircumradius));
+    // Start of Computation
+    if (world.rank() == 0) timer.start("Parallel Compute Region");
+    HeapCalls::start();
+
+    // halo bytes sent by this rank per phase of the schedule, the last entry for all sweeps and smoothing passes
+    std::vector<unsigned long long> phaseBytes(taskGroups.size() + 1, 0);
+    auto bytesSent = [&]() {
+        unsigned long long bytes = 0;
+        for (HaloTransport* blockTransport : blockTransports) bytes += blockTransport->stats.bytes;
+        return bytes;
+    };
+
+    // the triangulation of a block and one phase over all blocks, out-of-core through the cell store
+    auto block = [&](size_t b) -> LocalMesh& {
+        if (outOfCore && !cellStore.acquire(b)) world.abort(1);
+        return localMeshes[b];
+    };
+    auto runBlockPhase = [&](const std::vector<TaskGroup>& blockGroups, int phase) {
+        if (!outOfCore) {
+            runPhase(localMeshes, blockGroups, phase, blockTransports, shadows);
+        } else if (!runPhase(cellStore, blockGroups, phase, blockTransports)) {
+            world.abort(1);
         }
+    };
 
-        // post all async sends
-        for (auto& task : taskGroup.sendTasks) {
-            // check if that neighbor exists first (meshes on the edges has fewer neighbors)
-            std::optional<size_t> requestDestination = localMesh.neighbors[task.target.value()];
-            if (requestDestination.has_value()) {
-                // populate send buffer with points to send
-                Bbox2 sendBbox = task.bbox(&localMesh.bbox, localMesh.maxCircumradius);
-                SerializableMesh* buffer = new SerializableMesh();
-                buffer->insert(pointsInBbox(localMesh.mesh, sendBbox));
+    // loop through each taskGroup (phase)
+    for (int phase = lastPhase + 1; phase < int(taskGroups.size()); ++phase) {
+        unsigned long long bytesBefore = bytesSent();
+        runBlockPhase(std::vector<TaskGroup>(localMeshes.size(), taskGroups[phase]), phase);
+        phaseBytes[phase] = bytesSent() - bytesBefore;
 
-                mpi::request request = world.isend(requestDestination.value(), 0, buffer);
-                MeshUpdate update{request, sendBbox, buffer};
-                outgoingUpdates.push_back(update);
-            }
+#ifndef NDEBUG
+        // debug builds check the seams after every phase (blocks may still wait for halos of later phases)
+        validateSeams(world, localMeshes.size(), block, phase, blockTransports, "phase " + std::to_string(phase));
+#endif
+
+        // persist the state of this phase, so a failed run can restart from here
+        if (runtimeParameters.checkpointAfter(phase)) {
+            checkpointPhase(world, runtimeParameters.checkpointDir, localMeshes.front(), phase);
         }
+    }
 
-        // wait on all updates to complete
-        while (!incomingUpdates.empty() || !outgoingUpdates.empty()) {
-            // Iterate through outgoing updates
-            for (auto it = outgoingUpdates.begin(); it != outgoingUpdates.end();) {
-                if (it->request.test()) {
-                    delete it->buffer;
-                    it = outgoingUpdates.erase(it);
-                } else {
-                    ++it;
-                }
-            }
+    // sweep the schedule again where refinement left bad triangles (not checkpointed)
+    unsigned long long bytesBeforeSweeps = bytesSent();
+    int nextPhase = int(taskGroups.size());
+    runSweeps(world, localMeshes, block, runBlockPhase, taskGroups, nextPhase, runtimeParameters.maxSweeps, blockTransports);
 
-            // Iterate through incoming updates
-            for (auto it = incomingUpdates.begin(); it != incomingUpdates.end();) {
-                if (it->request.test()) {
-                    localMesh.updateBbox(it->targetBox, it->buffer);
-                    delete it->buffer;
-                    it = incomingUpdates.erase(it);
-                } else {
-                    ++it;
-                }
-            }
+    // smooth the refined mesh on the same schedule, so block borders move consistently (not checkpointed)
+    std::vector<TaskGroup> smoothingGroups = smoothingSchedule(taskGroups);
+    for (int pass = 0; pass < runtimeParameters.smoothingPasses; ++pass) {
+        for (auto& smoothingGroup : smoothingGroups) {
+            runBlockPhase(std::vector<TaskGroup>(localMeshes.size(), smoothingGroup), nextPhase++);
         }
     }
+    phaseBytes.back() = bytesSent() - bytesBeforeSweeps;
 
     // End of parallel compute
+    size_t heapCalls = HeapCalls::stop();
+    if (world.rank() == 0) timer.stop("Parallel Compute Region");
+    // cost of all bulk inserts during the parallel region, to compare insertion orders
+    InsertionStats stats;
+    ArenaStats arenaStats;
+    for (auto& localMesh : localMeshes) {
+        localMesh.arena.reset(); // closes the last phase in the arena statistics
+        stats.points += localMesh.insertionStats.points;
+        stats.insertMilliseconds += localMesh.insertionStats.insertMilliseconds;
+        stats.sortMilliseconds += localMesh.insertionStats.sortMilliseconds;
+        stats.cacheMisses = (stats.cacheMisses < 0 || localMesh.insertionStats.cacheMisses < 0) ? -1 : stats.cacheMisses + localMesh.insertionStats.cacheMisses;
+        arenaStats.overflows += localMesh.arena.stats.overflows;
+        arenaStats.growths += localMesh.arena.stats.growths;
+        arenaStats.peakBytes = std::max(arenaStats.peakBytes, localMesh.arena.stats.peakBytes);
+    }
+    size_t insertedPoints = mpi::all_reduce(world, stats.points, std::plus<size_t>());
+    double insertMilliseconds = mpi::all_reduce(world, stats.insertMilliseconds, mpi::maximum<double>());
+    double sortMilliseconds = mpi::all_reduce(world, stats.sortMilliseconds, mpi::maximum<double>());
+    long long cacheMisses = mpi::all_reduce(world, stats.cacheMisses, mpi::minimum<long long>()) < 0
+                                ? -1 : mpi::all_reduce(world, stats.cacheMisses, std::plus<long long>());
     if (world.rank() == 0) {
-        timer.stop("Parallel Compute Region");
+        std::cout << "Insertion [" << runtimeParameters.insertionOrder << "] " << insertedPoints << " points, sort "
+                  << sortMilliseconds << " ms, insert " << insertMilliseconds << " ms (slowest rank), ";
+        if (cacheMisses < 0) std::cout << "cache misses unavailable" << std::endl;
+        else std::cout << double(cacheMisses) / std::max<size_t>(insertedPoints, 1) << " cache misses/point" << std::endl;
+    }
 
-        std::vector<LocalMesh> localMeshes;
-        mpi::gather(world, localMesh, localMeshes, 0);
+    // halo exchange cost per transport (all blocks of a rank together), slowest rank
+    std::vector<std::pair<std::string, HaloStats>> haloReports;
+    for (size_t t = 0; t < transports.size(); ++t) {
+        if (t > 0 && t < localMeshes.size()) { // the block transports of one rank are reported as one
+            HaloStats& total = haloReports.front().second;
+            total.messages += transports[t]->stats.messages;
+            total.bytes += transports[t]->stats.bytes;
+            total.milliseconds += transports[t]->stats.milliseconds;
+        } else {
+            haloReports.push_back({transports[t]->name(), transports[t]->stats});
+        }
+    }
+    for (auto& [name, halo] : haloReports) {
+        double haloMilliseconds = mpi::all_reduce(world, halo.milliseconds, mpi::maximum<double>());
+        size_t haloBytes = mpi::all_reduce(world, halo.bytes, std::plus<size_t>());
+        size_t haloMessages = mpi::all_reduce(world, halo.messages, std::plus<size_t>());
+        if (world.rank() == 0) {
+            std::cout << "Halo [" << name << "] " << haloMessages << " messages, " << haloBytes << " bytes, "
+                      << haloMilliseconds << " ms (slowest rank)" << std::endl;
+        }
+    }
+
+    // halo volume of the block layout, one reduction for all phases
+    std::vector<unsigned long long> totalPhaseBytes(phaseBytes.size());
+    MPI_Reduce(phaseBytes.data(), totalPhaseBytes.data(), int(phaseBytes.size()), MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_Comm(world));
+    if (world.rank() == 0) {
+        std::cout << "Halo bytes per phase";
+        for (size_t phase = 0; phase + 1 < totalPhaseBytes.size(); ++phase) std::cout << " " << totalPhaseBytes[phase];
+        std::cout << ", sweeps and smoothing " << totalPhaseBytes.back() << std::endl;
+    }
+
+    // phase scratch allocations that did not fit the arenas (0 once they are large enough)
+    size_t arenaOverflows = mpi::all_reduce(world, arenaStats.overflows, std::plus<size_t>());
+    size_t arenaGrowths = mpi::all_reduce(world, arenaStats.growths, std::plus<size_t>());
+    size_t arenaPeak = mpi::all_reduce(world, arenaStats.peakBytes, mpi::maximum<size_t>());
+    size_t totalHeapCalls = mpi::all_reduce(world, heapCalls, std::plus<size_t>());
+    if (world.rank() == 0) {
+        std::cout << "Arena " << arenaOverflows << " overflow allocations, " << arenaGrowths << " growths, peak "
+                  << arenaPeak << " bytes per phase (largest rank)" << std::endl;
+        std::cout << "Heap " << totalHeapCalls << " allocations in the parallel region, Fade and halos included" << std::endl;
+    }
 
+    // neighboring blocks must agree along their seams (always checked in debug builds, after the halo statistics)
+#ifdef NDEBUG
+    if (runtimeParameters.validateSeams)
+#endif
+    {
+        validateSeams(world, localMeshes.size(), block, nextPhase, blockTransports, "end");
+    }
+
+    // quality of the owned triangles, reduced without gathering the mesh
+    if (!runtimeParameters.qualityReport.empty()) {
+        writeQualityReport(world, localMeshes.size(), block, runtimeParameters.qualityReport);
+    }
+
+    if (outOfCore) {
+        // every block writes its owned triangles to the part of its rank on its final eviction, rank 0 stitches the parts
+        Curve curve = runtimeParameters.outputOrder == "morton" ? Curve::Morton : Curve::Hilbert;
+        Bbox2 bbox;
+        for (auto& localMesh : localMeshes) bbox.add(localMesh.bbox);
+        SfcQuantizer quantizer(globalBbox(world, bbox), curve);
+        std::ofstream part(meshPartPath(runtimeParameters.outFilePath, world.rank()), std::ios::binary);
+        bool written = part.is_open();
+        for (size_t b = 0; b < localMeshes.size() && written; ++b) {
+            LocalMesh& localMesh = block(b);
+            written = appendMeshPart(part, sortOwnedTriangles(localMesh.mesh, localMesh.bbox, quantizer, localMesh.heights,
+                                                              [&](const Point2& p) { return localMesh.isInsideDomain(p); }));
+            cellStore.evict(b);
+        }
+        part.close();
+        if (!written) {
+            std::cout << "Can't write the output part of rank " << world.rank() << std::endl;
+            world.abort(1);
+        }
+        world.barrier();
+        size_t loads = mpi::all_reduce(world, cellStore.stats.loads, std::plus<size_t>());
+        size_t spills = mpi::all_reduce(world, cellStore.stats.spills, std::plus<size_t>());
+        if (world.rank() == 0) {
+            std::cout << "Out-of-core " << loads << " block loads, " << spills << " spills" << std::endl;
+            stitchMeshParts(runtimeParameters.outFilePath, world.size());
+            timer.stop("Total Time");
+        }
+    } else if (!runtimeParameters.outputOrder.empty() || terrain) {
+        // sort per rank along the curve, merge and write on rank 0 (with the heights of a terrain)
+        Curve curve = runtimeParameters.outputOrder == "morton" ? Curve::Morton : Curve::Hilbert;
+        saveCurveOrdered(world, localMeshes, runtimeParameters.outFilePath, curve);
+        if (world.rank() == 0) timer.stop("Total Time");
+    } else if (world.rank() == 0) {
+        // receive the refined blocks one at a time and merge their triangles
         GlobalMesh outputMesh(runtimeParameters);
         outputMesh.loadFromLocalMeshes(localMeshes);
+        for (int rank = 1; rank < world.size(); ++rank) {
+            for (int slot = 0; slot < blocksPerRank; ++slot) {
+                LocalMesh received;
+                world.recv(rank, slot, received);
+                outputMesh.loadFromLocalMesh(received);
+            }
+        }
         outputMesh.saveToPLY();
 
         timer.stop("Total Time");
     } else {
-        // worker send local mesh
-        mpi::gather(world, localMesh, 0);
+        // worker send local meshes
+        for (int slot = 0; slot < blocksPerRank; ++slot) {
+            world.send(0, slot, localMeshes[slot]);
+        }
     }
 
     return 0;
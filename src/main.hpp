@@ -1,9 +1,12 @@
+#pragma once
+
 #include <optional>
 #include <stdio.h>
 #include <algorithm>
 #include <iostream>
 #include <unistd.h>
 #include <fstream>
+#include <sstream>
 #include <iomanip>
 #include <chrono>
 #include <string>
@@ -11,25 +14,254 @@
 #include <random>
 #include <thread>
 #include <cassert>
+#include <cmath>
+#include <limits>
+#include <memory_resource>
 #include <functional>
+#include <memory>
 
 #include <Fade_2D.h>
 #include <boost/mpi.hpp>
 #include <boost/bimap.hpp>
 #include <boost/serialization/optional.hpp>
+#include <boost/serialization/vector.hpp>
+
+#include "constraint.hpp"
+#include "meshio.hpp"
+#include "insertion.hpp"
+#include "arena.hpp"
+#include "snapshot.hpp"
+#include "heights.hpp"
 
 using namespace GEOM_FADE2D;
 namespace mpi = boost::mpi;
 
+// printed for --help by both executables, one line per flag of RuntimeParameters
+const char *const usageText = R"(usage: dmr [options] <input.ply> [<output.ply>]
+       dmr_threaded [options] <input.ply> [<output.ply>]
+dmr_threaded takes the input options, --threads, --blocks-per-rank, --arena-mb and
+--output-order; all others are for dmr.
+
+input
+  --boundary <file>            outer polygons and holes of the domain
+  --terrain <file.xyz>         x y z samples, triangulated with heights
+  --height-tolerance <h>       also refine until every triangle is within h of the samples (0 off)
+  --load-mesh <file>           start from a saved binary mesh instead of the input points
+  --save-mesh <file>           save the pre-refined mesh with one block per block of the split
+  --insertion-order <order>    fade|morton|brio for all bulk inserts (default morton)
+
+decomposition
+  --blocks-per-rank <k>        blocks of the grid per MPI rank or per thread (default 1)
+  --hierarchical               cut among nodes first, then among the ranks of a node
+  --threads <n>                workers of dmr_threaded (default one per hardware thread)
+  --resident-cells <m>         out-of-core from --load-mesh: at most m blocks of a rank in memory (0 keeps all)
+  --spill-dir <dir>            where out-of-core blocks are kept (default .)
+
+refinement
+  --max-sweeps <n>             repeat the schedule up to n times until no bad triangles are left
+  --smooth <passes>            smoothing passes over the schedule after refinement (default 0)
+  --smooth-iterations <n>      Laplacian iterations per smoothing box (default 2)
+
+halos
+  --halo-transport <name>      graph|boost|raw|shm (default graph)
+  --halo-benchmark             also time the other transports on the same halos
+  --halo-shm-mb <mb>           shared halo buffer per rank of the shm transport (default 64)
+  --arena-mb <mb>              initial phase arena of every block (default 16)
+
+output
+  --output-order <curve>       hilbert|morton, vertices and triangles along the curve
+  --quality-report <file>      mesh quality histograms as JSON
+  --validate-seams             check that neighboring blocks agree along their seams
+
+checkpoints
+  --checkpoint <dir>           checkpoint after every phase into dir
+  --checkpoint-phases <list>   only after these phases, e.g. 1,3
+  --restart                    resume from the last complete checkpoint in the --checkpoint dir
+)";
+
 struct RuntimeParameters
 {
-    std::string inFilePath;
-    std::string outFilePath;
+    std::string inFilePath;              // first positional argument, input points (.ply, see GlobalMesh::loadPoints)
+    std::string outFilePath = "out.ply"; // second positional argument, the refined mesh
     int numProcessors;
+
+    std::string boundaryPath; // --boundary <file>, outer polygons and holes of the domain (see readPolygons)
+
+    // binary mesh files (see meshio.hpp)
+    std::string saveMeshPath; // --save-mesh <file>, write the pre-refined mesh with one block per block of the split
+    std::string loadMeshPath; // --load-mesh <file>, start from a saved mesh instead of the input points
     // MeshGenParams meshGenParams;
 
+    // checkpoint/restart (see checkpoint.hpp)
+    std::string checkpointDir;         // --checkpoint <dir>, empty disables checkpoints
+    std::vector<int> checkpointPhases; // --checkpoint-phases 1,3 (empty means after every phase)
+    bool restart = false;              // --restart, resume from the last complete checkpoint
+
+    std::string outputOrder; // --output-order hilbert|morton, empty keeps Fade's order
+
+    bool validateSeams = false; // --validate-seams, check that neighboring blocks agree along their seams at the end (see seams.hpp)
+    std::string qualityReport; // --quality-report <file.json>, distributed mesh quality histograms (see quality.hpp)
+
+    bool hierarchical = false; // --hierarchical, cut the domain among nodes first, then among the ranks of a node (see blocks.hpp)
+
+    std::string insertionOrder = "morton"; // --insertion-order fade|morton|brio for all bulk inserts
+
+    std::string haloTransport = "graph"; // --halo-transport graph|boost|raw|shm (see halo.hpp)
+    bool haloBenchmark = false;          // --halo-benchmark, also time the other transports on the same halos
+    size_t haloShmBytes = 64 << 20;      // --halo-shm-mb, per rank shared halo buffer of the shm transport
+
+    size_t arenaBytes = 16 << 20; // --arena-mb, initial phase arena of every local mesh (see arena.hpp)
+
+    int numThreads = 0; // --threads, workers of the threaded backend (0 is one per hardware thread)
+
+    // --blocks-per-rank, blocks of the grid per MPI rank, dealt along a Hilbert curve (see blocks.hpp),
+    // or per worker of the threaded backend, so both backends cut the same grid for as many workers
+    int blocksPerRank = 1;
+
+    size_t residentCells = 0; // --resident-cells, out-of-core: at most this many blocks of a rank in memory, 0 keeps all (see outofcore.hpp)
+    std::string spillDir = "."; // --spill-dir, where out-of-core blocks are kept (removed once written to the output)
+
+    std::string terrainPath;     // --terrain <file.xyz>, x y z samples to triangulate with heights (see heights.hpp)
+    double heightTolerance = 0;  // --height-tolerance, also refine until every triangle is this close to the input surface, 0 disables
+
+    int smoothingPasses = 0;    // --smooth <passes>, smoothing passes over the schedule after refinement (see smoothingSchedule)
+    int smoothingIterations = 2; // --smooth-iterations, Laplacian iterations per smoothing box (see LocalMesh::smoothBbox)
+
+    int maxSweeps = 0; // --max-sweeps, repeat the schedule up to this often until no bad triangles are left (see convergence.hpp)
+
+    bool help = false; // --help, print usageText and exit
+
     RuntimeParameters(int argc, char **argv)
     {
+        int positional = 0;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "--checkpoint" && i + 1 < argc)
+            {
+                checkpointDir = argv[++i];
+            }
+            else if (arg == "--checkpoint-phases" && i + 1 < argc)
+            {
+                std::stringstream phases(argv[++i]);
+                std::string phase;
+                while (std::getline(phases, phase, ','))
+                {
+                    checkpointPhases.push_back(std::stoi(phase));
+                }
+            }
+            else if (arg == "--restart")
+            {
+                restart = true;
+            }
+            else if (arg == "--output-order" && i + 1 < argc)
+            {
+                outputOrder = argv[++i];
+            }
+            else if (arg == "--validate-seams")
+            {
+                validateSeams = true;
+            }
+            else if (arg == "--quality-report" && i + 1 < argc)
+            {
+                qualityReport = argv[++i];
+            }
+            else if (arg == "--hierarchical")
+            {
+                hierarchical = true;
+            }
+            else if (arg == "--insertion-order" && i + 1 < argc)
+            {
+                insertionOrder = argv[++i];
+            }
+            else if (arg == "--halo-transport" && i + 1 < argc)
+            {
+                haloTransport = argv[++i];
+            }
+            else if (arg == "--halo-benchmark")
+            {
+                haloBenchmark = true;
+            }
+            else if (arg == "--halo-shm-mb" && i + 1 < argc)
+            {
+                haloShmBytes = size_t(std::stoul(argv[++i])) << 20;
+            }
+            else if (arg == "--arena-mb" && i + 1 < argc)
+            {
+                arenaBytes = size_t(std::stoul(argv[++i])) << 20;
+            }
+            else if (arg == "--threads" && i + 1 < argc)
+            {
+                numThreads = std::stoi(argv[++i]);
+            }
+            else if (arg == "--blocks-per-rank" && i + 1 < argc)
+            {
+                blocksPerRank = std::max(1, std::stoi(argv[++i]));
+            }
+            else if (arg == "--resident-cells" && i + 1 < argc)
+            {
+                residentCells = size_t(std::stoul(argv[++i]));
+            }
+            else if (arg == "--spill-dir" && i + 1 < argc)
+            {
+                spillDir = argv[++i];
+            }
+            else if (arg == "--terrain" && i + 1 < argc)
+            {
+                terrainPath = argv[++i];
+            }
+            else if (arg == "--height-tolerance" && i + 1 < argc)
+            {
+                heightTolerance = std::max(0.0, std::stod(argv[++i]));
+            }
+            else if (arg == "--smooth" && i + 1 < argc)
+            {
+                smoothingPasses = std::max(0, std::stoi(argv[++i]));
+            }
+            else if (arg == "--smooth-iterations" && i + 1 < argc)
+            {
+                smoothingIterations = std::max(1, std::stoi(argv[++i]));
+            }
+            else if (arg == "--max-sweeps" && i + 1 < argc)
+            {
+                maxSweeps = std::max(0, std::stoi(argv[++i]));
+            }
+            else if (arg == "--boundary" && i + 1 < argc)
+            {
+                boundaryPath = argv[++i];
+            }
+            else if (arg == "--save-mesh" && i + 1 < argc)
+            {
+                saveMeshPath = argv[++i];
+            }
+            else if (arg == "--load-mesh" && i + 1 < argc)
+            {
+                loadMeshPath = argv[++i];
+            }
+            else if (arg == "--help")
+            {
+                help = true;
+            }
+            else if (arg.rfind("--", 0) != 0)
+            {
+                (positional++ == 0 ? inFilePath : outFilePath) = arg;
+            }
+        }
+    }
+
+    // blocks of the grid for workers MPI ranks or threads
+    int numBlocks(int workers) const
+    {
+        return workers * blocksPerRank;
+    }
+
+    bool checkpointAfter(int phase) const
+    {
+        if (checkpointDir.empty())
+        {
+            return false;
+        }
+        return checkpointPhases.empty() || std::find(checkpointPhases.begin(), checkpointPhases.end(), phase) != checkpointPhases.end();
     }
 };
 
@@ -89,11 +321,14 @@ public:
 class SerializableMesh : public Fade_2D
 {
 public:
+    // constraint pieces travelling with the mesh (split ConstraintSegment2s of the sender)
+    std::vector<Segment2> constraintSegments;
+
     /*
     Serializer for boost::serialization
     */
     template <class Archive>
-    void serialize(Archive &archive, const unsigned version)
+    void serialize(Archive &archive, const unsigned /* version */)
     {
         std::string meshData;
         if (Archive::is_saving::value)
@@ -115,19 +350,22 @@ public:
         if (Archive::is_loading::value)
         {
             // Deserialization
-            std::istringstream stream;
-            stream >> meshData;
+            std::istringstream stream(meshData);
             std::vector<Zone2 *> zoneVector;
             load(stream, zoneVector);
         }
-    }
-};
 
-struct MeshUpdate
-{
-    mpi::request request;
-    Bbox2 targetBox;
-    SerializableMesh *buffer;
+        std::vector<double> segmentData;
+        if (Archive::is_saving::value)
+        {
+            segmentData = flattenSegments(constraintSegments);
+        }
+        archive & segmentData;
+        if (Archive::is_loading::value)
+        {
+            constraintSegments = unflattenSegments(segmentData);
+        }
+    }
 };
 
 // MESH
@@ -147,12 +385,102 @@ enum class Neighbor
     BR
 };
 
-std::vector<Triangle2 *> trianglesInBbox(SerializableMesh &mesh, Bbox2 bbox)
+const std::vector<Neighbor> allNeighbors = {Neighbor::Left, Neighbor::Right, Neighbor::Top, Neighbor::Bottom,
+                                            Neighbor::TL, Neighbor::TR, Neighbor::BL, Neighbor::BR};
+
+/*
+Direction in which the neighbor in direction `neighbor` sees this mesh.
+*/
+Neighbor opposite(Neighbor neighbor)
 {
+    switch (neighbor)
+    {
+    case Neighbor::Left: return Neighbor::Right;
+    case Neighbor::Right: return Neighbor::Left;
+    case Neighbor::Top: return Neighbor::Bottom;
+    case Neighbor::Bottom: return Neighbor::Top;
+    case Neighbor::TL: return Neighbor::BR;
+    case Neighbor::TR: return Neighbor::BL;
+    case Neighbor::BL: return Neighbor::TR;
+    default: return Neighbor::TL;
+    }
 }
 
-std::vector<Point2> pointsInBbox(SerializableMesh &mesh, Bbox2 bbox)
+// quality bound of every refinement (smallest interior angle)
+const double minAngleDegrees = 20;
+
+// bound of the sequential pre-refinement before the split (see GlobalMesh::refineMesh)
+const double initialAngleDegrees = 10;
+
+// at most this many height refinement rounds per refineBbox (see LocalMesh::heightTolerance)
+const int maxHeightRounds = 8;
+
+/*
+Smallest interior angle of triangle in degrees (opposite its shortest edge).
+*/
+double minInteriorAngle(Triangle2 *triangle)
 {
+    // squared edge lengths, sorted: the smallest angle lies between the two longer edges
+    double lengths[3] = {sqDistance2D(*triangle->getCorner(1), *triangle->getCorner(2)),
+                         sqDistance2D(*triangle->getCorner(2), *triangle->getCorner(0)),
+                         sqDistance2D(*triangle->getCorner(0), *triangle->getCorner(1))};
+    std::sort(lengths, lengths + 3);
+    double cosine = (lengths[1] + lengths[2] - lengths[0]) / (2 * std::sqrt(lengths[1] * lengths[2]));
+    return std::acos(std::clamp(cosine, -1.0, 1.0)) * 180 / M_PI;
+}
+
+/*
+Triangles whose barycenter lies in bbox, allocated from the phase arena.
+*/
+std::pmr::vector<Triangle2 *> trianglesInBbox(SerializableMesh &mesh, Bbox2 bbox, PhaseArena &arena)
+{
+    std::pmr::vector<Triangle2 *> result(arena.resource());
+    arena.triangles.clear();
+    mesh.getTrianglePointers(arena.triangles);
+    for (auto &triangle : arena.triangles)
+    {
+        if (bbox.isInBox(triangle->getBarycenter()))
+        {
+            result.push_back(triangle);
+        }
+    }
+    return result;
+}
+
+/*
+Vertices in bbox, found with the vectorized filter of the vertex snapshot.
+*/
+std::pmr::vector<Point2> pointsInBbox(const VertexSnapshot &snapshot, Bbox2 bbox, PhaseArena &arena)
+{
+    std::pmr::vector<uint32_t> indices(arena.resource());
+    snapshot.filter(bbox, indices);
+    std::pmr::vector<Point2> result(arena.resource());
+    result.reserve(indices.size());
+    for (uint32_t i : indices)
+    {
+        result.push_back(Point2(snapshot.x[i], snapshot.y[i]));
+    }
+    return result;
+}
+
+/*
+Alive (i.e. already split by refinement) constraint pieces whose midpoint lies in bbox.
+Pieces never straddle a task box (see gridLines), so the midpoint decides ownership.
+*/
+std::pmr::vector<Segment2> constraintsInBbox(SerializableMesh &mesh, Bbox2 bbox, PhaseArena &arena)
+{
+    std::pmr::vector<Segment2> result(arena.resource());
+    arena.segments.clear();
+    mesh.getAliveConstraintSegments(arena.segments);
+    for (auto &segment : arena.segments)
+    {
+        Segment2 piece(*segment->getSrc(), *segment->getTrg());
+        if (bbox.isInBox(segmentMidpoint(piece)))
+        {
+            result.push_back(piece);
+        }
+    }
+    return result;
 }
 
 struct LocalMesh
@@ -168,7 +496,33 @@ struct LocalMesh
     std::unordered_map<Neighbor, std::optional<size_t>> neighbors;
 
     // Parameters
-    int maxCircumradius; // max circumradius in the entire mesh
+    double maxCircumradius; // max circumradius in the entire mesh
+
+    // Domain boundary (outer polygons and holes) clipped to the halo of this mesh.
+    // Inside/outside is decided with the even-odd rule, so holes need no extra bookkeeping.
+    bool constrained = false;
+    std::vector<Segment2> constraints;
+    ExteriorParity exteriorParity;
+
+    // order and cost of the bulk inserts into mesh (see insertion.hpp)
+    InsertionOrder insertionOrder = InsertionOrder::Morton;
+    InsertionStats insertionStats;
+
+    // scratch memory of the current phase, reset at the start of every phase (not serialized)
+    PhaseArena arena;
+
+    // SoA copy of the vertices of mesh for bbox queries, kept in step by updateBbox and refineBbox (not serialized)
+    VertexSnapshot snapshot;
+
+    // Terrain: heights of the vertices (empty without), the input samples of the halo as x y z
+    // (see terrainSurface), and the largest allowed height error of a triangle against the
+    // samples' surface (0 refines for angles only)
+    HeightTable heights;
+    std::vector<double> samples;
+    double heightTolerance = 0;
+
+    // Laplacian iterations of every smoothBbox
+    int smoothingIterations = 2;
 
     LocalMesh()
     {
@@ -176,57 +530,467 @@ struct LocalMesh
     }
 
     /*
-    Delete all the triangle in the provided Bbox.
-    Then insert all the triangles in the provided serializedTriangulation in to mesh.
-    A new Zone2 should be created, the corresponding field in the struct updated.
+    Insert the clipped boundary pieces into the triangulation as constrained edges.
+    */
+    void applyConstraints()
+    {
+        if (!constraints.empty())
+        {
+            mesh.createConstraint(constraints, CIS_CONSTRAINED_DELAUNAY);
+        }
+    }
+
+    /*
+    Even-odd test of p against the global boundary: crossings with the local pieces
+    plus the precomputed crossings beyond the right edge of the halo.
+    */
+    bool isInsideDomain(const Point2 &p) const
+    {
+        if (!constrained)
+        {
+            return true;
+        }
+        bool inside = exteriorParity.at(p.y());
+        for (auto &piece : constraints)
+        {
+            if (crossesRay(piece, p.x(), p.y()))
+            {
+                inside = !inside;
+            }
+        }
+        return inside;
+    }
+
+    /*
+    The vertex snapshot of mesh, rebuilt if the mesh was changed behind its back
+    (initial split, scatter, checkpoint restore).
+    */
+    VertexSnapshot &vertices()
+    {
+        snapshot.sync(mesh);
+        return snapshot;
+    }
+
+    /*
+    Triangles in the provided Bbox that belong to the domain (i.e. not in a hole or outside).
+    The result is the arena's zone list, valid until the next call.
+    */
+    std::vector<Triangle2 *> &domainTriangles(const Bbox2 &bbox)
+    {
+        arena.zoneTriangles.clear();
+        for (auto &triangle : trianglesInBbox(mesh, bbox, arena))
+        {
+            if (isInsideDomain(triangle->getBarycenter()))
+            {
+                arena.zoneTriangles.push_back(triangle);
+            }
+        }
+        return arena.zoneTriangles;
+    }
+
+    /*
+    Delete all the vertices in the provided Bbox.
+    Then insert the incoming vertices and constraint pieces into mesh.
+    Constraint vertices cannot be removed (see Fade_2D::remove), they stay and the incoming
+    pieces are inserted on top of them. Both sides hold pieces of the same canonical segments,
+    so overlapping pieces merge and the split points become the union of both ranks' splits.
+    */
+    void updateBbox(const Bbox2 &bbox, std::pmr::vector<Point2> &incomingPoints, const std::pmr::vector<Segment2> &incomingSegments,
+                    const std::pmr::vector<double> &incomingHeights = {})
+    {
+        snapshot.sync(mesh);
+        std::pmr::vector<uint32_t> indices(arena.resource());
+        snapshot.filter(bbox, indices);
+        arena.removed.clear();
+        for (uint32_t i : indices)
+        {
+            if (!mesh.isConstraint(snapshot.handles[i]))
+            {
+                arena.removed.push_back(snapshot.handles[i]);
+            }
+        }
+        for (auto &vertex : arena.removed)
+        {
+            snapshot.remove(vertex);
+        }
+        mesh.remove(arena.removed);
+
+        // incoming heights are parallel to incomingPoints, NaN for a point without one;
+        // a point may carry the sender's slot, which means nothing here
+        for (size_t i = 0; i < incomingPoints.size(); ++i)
+        {
+            incomingPoints[i].setCustomIndex(-1);
+            if (i < incomingHeights.size() && !std::isnan(incomingHeights[i]))
+            {
+                heights.assign(incomingPoints[i], incomingHeights[i]);
+            }
+        }
+        auto handles = bulkInsert(mesh, incomingPoints, insertionOrder, &insertionStats, arena.resource());
+        heights.bind(incomingPoints, handles);
+        for (Point2 *vertex : handles)
+        {
+            snapshot.add(vertex);
+        }
+        heights.compact(mesh);
+        // constraint pieces only add vertices at their endpoints, which are inserted above
+        if (!incomingSegments.empty())
+        {
+            arena.pieces.assign(incomingSegments.begin(), incomingSegments.end());
+            mesh.createConstraint(arena.pieces, CIS_CONSTRAINED_DELAUNAY);
+        }
+    }
+
+    /*
+    Same as above with the vertices and constraint pieces of incomingMesh.
+    */
+    void updateBbox(const Bbox2 &bbox, SerializableMesh *incomingMesh)
+    {
+        arena.vertices.clear();
+        incomingMesh->getVertexPointers(arena.vertices);
+        std::pmr::vector<Point2> incomingPoints(arena.resource());
+        incomingPoints.reserve(arena.vertices.size());
+        for (auto &vertex : arena.vertices)
+        {
+            incomingPoints.push_back(*vertex);
+        }
+        std::pmr::vector<Segment2> incomingSegments(incomingMesh->constraintSegments.begin(), incomingMesh->constraintSegments.end(), arena.resource());
+        updateBbox(bbox, incomingPoints, incomingSegments);
+    }
+
+    /*
+    Refine the part of the domain inside the provided Bbox as one zone.
+    Constraint splitting is allowed: an encroached piece is split at its midpoint, which
+    is the same point on every rank because the pieces themselves are identical.
+    On a terrain the new vertices get their heights from the surface of the input samples
+    (see terrainSurface), and with a heightTolerance the zone is refined again where it
+    deviates from that surface (see insertHeightPoints).
+    */
+    void refineBbox(const Bbox2 &bbox)
+    {
+        std::unique_ptr<TerrainSurface> surface;
+        for (int round = 0;; ++round)
+        {
+            std::vector<Triangle2 *> &triangles = domainTriangles(bbox);
+            if (triangles.empty())
+            {
+                return;
+            }
+            // refine needs a bounded zone (see Fade_2D::refine), and its vertices afterwards are the new ones plus the old
+            Zone2 *zone = mesh.createZone(triangles, false);
+            Zone2 *boundedZone = zone->convertToBoundedZone();
+            if (!samples.empty() && !surface)
+            {
+                surface = terrainSurface(bbox);
+            }
+            // in step before refine, so only the new vertices are added below (as in updateBbox)
+            snapshot.sync(mesh);
+            mesh.refine(boundedZone, minAngleDegrees, 0, std::numeric_limits<double>::max(), true);
+
+            arena.vertices.clear();
+            boundedZone->getVertices(arena.vertices);
+            for (auto &vertex : arena.vertices)
+            {
+                snapshot.add(vertex);
+            }
+            if (surface)
+            {
+                interpolateHeights(arena.vertices, *surface);
+            }
+            mesh.deleteZone(boundedZone);
+            mesh.deleteZone(zone);
+
+            if (!surface || heightTolerance <= 0 || round == maxHeightRounds || insertHeightPoints(bbox, *surface) == 0)
+            {
+                return;
+            }
+        }
+    }
+
+    /*
+    Triangulation of the input samples within 2r of bbox (beyond it, refinement of bbox
+    can't place vertices): the surface refinement of bbox must keep. Built from the samples,
+    not from the mesh, so Steiner points and height points of earlier refinements never
+    become part of it and the error is always measured against the input.
     */
-    void updateBbox(Bbox2 *bbox, SerializableMesh *incomingMesh)
+    std::unique_ptr<TerrainSurface> terrainSurface(const Bbox2 &bbox)
     {
-        std::vector<Point2 *> vertices = mesh->getVertexPointers();
-        for (Point2 vertex : vertices)
+        double margin = 2 * maxCircumradius;
+        std::pmr::vector<Point2> points(arena.resource());
+        auto surface = std::make_unique<TerrainSurface>();
+        for (size_t i = 0; i + 2 < samples.size(); i += 3)
         {
-            if (bbox->isInBox(vertex))
+            if (samples[i] >= bbox.get_minX() - margin && samples[i] <= bbox.get_maxX() + margin &&
+                samples[i + 1] >= bbox.get_minY() - margin && samples[i + 1] <= bbox.get_maxY() + margin)
             {
-                // remove
-                mesh.remove(vertex);
+                points.push_back(Point2(samples[i], samples[i + 1]));
+                surface->heights.assign(points.back(), samples[i + 2]);
             }
         }
-        std::vector<Point2 *> vertices_in = incomingMesh->getVertexPointers();
-        for (Point2 vertex : vertices_in)
+        surface->heights.bind(points, bulkInsert(surface->mesh, points, insertionOrder, nullptr, arena.resource()));
+        return surface;
+    }
+
+    /*
+    Give the vertices without a height (Steiner points) the height of surface at their position,
+    or the mean height of their neighbors if surface doesn't cover them.
+    */
+    template <class Vertices>
+    void interpolateHeights(const Vertices &vertices, TerrainSurface &surface)
+    {
+        for (auto &vertex : vertices)
+        {
+            if (heights.has(*vertex))
+            {
+                continue;
+            }
+            Triangle2 *source = surface.mesh.locate(*vertex);
+            if (source != nullptr && hasHeights(surface.heights, source))
+            {
+                heights.assign(*vertex, interpolateHeight(surface.heights, source, *vertex));
+                continue;
+            }
+            arena.triangles.clear();
+            mesh.getIncidentTriangles(vertex, arena.triangles);
+            double sum = 0;
+            int count = 0;
+            for (auto &triangle : arena.triangles)
+            {
+                Point2 &neighbor = *triangle->getCorner((triangle->getIntraTriangleIndex(vertex) + 1) % 3);
+                if (heights.has(neighbor))
+                {
+                    sum += heights.at(neighbor);
+                    count += 1;
+                }
+            }
+            if (count > 0)
+            {
+                heights.assign(*vertex, sum / count);
+            }
+        }
+    }
+
+    /*
+    Height error criterion: insert the barycenter, at the height of surface, of every domain
+    triangle in bbox whose plane is more than heightTolerance off surface there.
+    Returns the number of inserted points.
+    */
+    size_t insertHeightPoints(const Bbox2 &bbox, TerrainSurface &surface)
+    {
+        std::pmr::vector<Point2> points(arena.resource());
+        for (auto &triangle : domainTriangles(bbox))
+        {
+            Point2 barycenter = triangle->getBarycenter();
+            Triangle2 *source = surface.mesh.locate(barycenter);
+            if (!hasHeights(heights, triangle) || source == nullptr || !hasHeights(surface.heights, source))
+            {
+                continue;
+            }
+            double height = interpolateHeight(surface.heights, source, barycenter);
+            if (std::fabs(interpolateHeight(heights, triangle, barycenter) - height) > heightTolerance)
+            {
+                points.push_back(barycenter);
+                heights.assign(points.back(), height);
+            }
+        }
+        snapshot.sync(mesh);
+        auto handles = bulkInsert(mesh, points, insertionOrder, &insertionStats, arena.resource());
+        heights.bind(points, handles);
+        for (Point2 *vertex : handles)
+        {
+            snapshot.add(vertex);
+        }
+        return points.size();
+    }
+
+    /*
+    Target of vertex under Laplacian smoothing (the mean of its neighbors), if it may move:
+    its whole star is domain inside bbox, it is not on the hull, and the target keeps every
+    triangle of the star counterclockwise.
+    */
+    bool laplacianTarget(Point2 *vertex, const Bbox2 &bbox, Point2 &target)
+    {
+        arena.triangles.clear();
+        mesh.getIncidentTriangles(vertex, arena.triangles);
+        if (arena.triangles.empty())
+        {
+            return false;
+        }
+        double sumX = 0, sumY = 0;
+        for (auto &triangle : arena.triangles)
+        {
+            int i = triangle->getIntraTriangleIndex(vertex);
+            Point2 barycenter = triangle->getBarycenter();
+            if (!bbox.isInBox(barycenter) || !isInsideDomain(barycenter) || triangle->getOppositeTriangle((i + 2) % 3) == nullptr)
+            {
+                return false;
+            }
+            sumX += triangle->getCorner((i + 1) % 3)->x();
+            sumY += triangle->getCorner((i + 1) % 3)->y();
+        }
+        target = Point2(sumX / arena.triangles.size(), sumY / arena.triangles.size());
+        for (auto &triangle : arena.triangles)
+        {
+            int i = triangle->getIntraTriangleIndex(vertex);
+            Point2 &a = *triangle->getCorner((i + 1) % 3), &b = *triangle->getCorner((i + 2) % 3);
+            if ((a.x() - target.x()) * (b.y() - target.y()) - (a.y() - target.y()) * (b.x() - target.x()) <= 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /*
+    Laplacian smoothing of the domain inside bbox (Fade_2D has no Zone2::smoothing, that is
+    Fade2.5D): every movable vertex (see laplacianTarget) goes to the mean of its neighbors,
+    all at once per iteration, by removing and reinserting them, so the result is Delaunay
+    again, smoothingIterations times. Constraint vertices and vertices near the box edges stay.
+    */
+    void smoothBbox(const Bbox2 &bbox)
+    {
+        for (int iteration = 0; iteration < smoothingIterations; ++iteration)
+        {
+            snapshot.sync(mesh);
+            std::pmr::vector<uint32_t> indices(arena.resource());
+            snapshot.filter(bbox, indices);
+            std::pmr::vector<Point2> targets(arena.resource());
+            arena.removed.clear();
+            for (uint32_t i : indices)
+            {
+                Point2 *vertex = snapshot.handles[i];
+                Point2 target;
+                if (!mesh.isConstraint(vertex) && laplacianTarget(vertex, bbox, target))
+                {
+                    arena.removed.push_back(vertex);
+                    targets.push_back(target);
+                    // a terrain vertex slides over the surface: its height is taken where it lands
+                    Triangle2 *source = heights.empty() ? nullptr : mesh.locate(target);
+                    if (source != nullptr && hasHeights(heights, source))
+                    {
+                        heights.assign(targets.back(), interpolateHeight(heights, source, target));
+                    }
+                }
+            }
+            if (arena.removed.empty())
+            {
+                return;
+            }
+            for (auto &vertex : arena.removed)
+            {
+                snapshot.remove(vertex);
+            }
+            mesh.remove(arena.removed);
+            auto handles = bulkInsert(mesh, targets, insertionOrder, &insertionStats, arena.resource());
+            heights.bind(targets, handles);
+            for (Point2 *vertex : handles)
+            {
+                snapshot.add(vertex);
+            }
+        }
+        heights.compact(mesh);
+    }
+
+    /*
+    Number of domain triangles in the provided Bbox that are still below the angle bound.
+    A small tolerance keeps triangles that refine left at the bound (up to rounding) out.
+    */
+    size_t badTriangles(const Bbox2 &bbox)
+    {
+        size_t count = 0;
+        for (auto &triangle : domainTriangles(bbox))
         {
-            mesh.insert(vertices_in)
+            if (minInteriorAngle(triangle) < minAngleDegrees - 0.01)
+            {
+                count += 1;
+            }
         }
+        return count;
     }
 
     /*
-    Refine the provided list of zones as one zone (not sequentially)
+    Neighbors of the block at (row, col) of a cols x rows grid, as block numbers row * cols + col.
     */
-    void refineBbox(Bbox2 *bbox)
-    { // currently redoing
-        Bbox2 unioned = Bbox2();
-        for (Bbox2 box : bbox)
+    void setGridNeighbors(int row, int col, int cols, int rows)
+    {
+        auto neighbor = [&](int dCol, int dRow) -> std::optional<size_t>
         {
-            unioned = unioned.add(box)
+            int c = col + dCol, rr = row + dRow;
+            if (c < 0 || c >= cols || rr < 0 || rr >= rows)
+            {
+                return std::nullopt;
+            }
+            return size_t(rr * cols + c);
+        };
+        neighbors[Neighbor::Left] = neighbor(-1, 0);
+        neighbors[Neighbor::Right] = neighbor(1, 0);
+        neighbors[Neighbor::Top] = neighbor(0, -1);
+        neighbors[Neighbor::Bottom] = neighbor(0, 1);
+        neighbors[Neighbor::TL] = neighbor(-1, -1);
+        neighbors[Neighbor::TR] = neighbor(1, -1);
+        neighbors[Neighbor::BL] = neighbor(-1, 1);
+        neighbors[Neighbor::BR] = neighbor(1, 1);
+    }
+
+    /*
+    Map only block `block` of a binary mesh file written by GlobalMesh::saveToBinary and build
+    the (empty) mesh from it the way GlobalMesh::fillBlock does: a bulk insert of the block's
+    points including its halo, bbox and grid neighbors from the block table. The halo width is
+    the largest circumradius of the stored triangles, reduce it over all blocks before refining.
+    Unconstrained meshes only, the file holds no boundary.
+    */
+    bool loadFromBinary(const std::string &path, size_t block)
+    {
+        MappedMesh mapped;
+        if (!mapped.openBlock(path, block))
+        {
+            return false;
         }
+        const MeshFileBlock &entry = mapped.blocks[block];
+        bbox.setMinX(entry.minX);
+        bbox.setMinY(entry.minY);
+        bbox.setMaxX(entry.maxX);
+        bbox.setMaxY(entry.maxY);
+        maxCircumradius = mapped.maxCircumradius();
+        int cols = mapped.gridCols();
+        setGridNeighbors(int(block) / cols, int(block) % cols, cols, int(mapped.blocks.size()) / cols);
+        mapped.insertPoints(mesh, insertionOrder, &insertionStats);
+        return true;
     }
 
     /*
     Serializer for boost::serialization
     */
     template <class Archive>
-    void serialize(Archive &archive, const unsigned version)
+    void serialize(Archive &archive, const unsigned /* version */)
     {
         archive & mesh;
-        // TODO archive & neighbors;
         archive & maxCircumradius;
 
+        // in allNeighbors order, -1 for none (boost has no std::optional serializer)
+        std::vector<long long> neighborData;
+        if (Archive::is_saving::value)
+        {
+            for (Neighbor neighbor : allNeighbors)
+            {
+                neighborData.push_back(neighbors[neighbor].has_value() ? (long long)neighbors[neighbor].value() : -1);
+            }
+        }
+        archive & neighborData;
+        if (Archive::is_loading::value)
+        {
+            for (size_t i = 0; i < neighborData.size(); ++i)
+            {
+                neighbors[allNeighbors[i]] = neighborData[i] < 0 ? std::nullopt : std::optional<size_t>(size_t(neighborData[i]));
+            }
+        }
+
         std::vector<double> bboxData;
         if (Archive::is_saving::value)
         {
             // Serialization
             bboxData = {bbox.get_minX(), bbox.get_minY(), bbox.get_maxX(), bbox.get_maxY()};
         }
-        // TODO archive & bboxData;
+        archive & bboxData;
         if (Archive::is_loading::value)
         {
             // Deserialization
@@ -235,86 +999,386 @@ struct LocalMesh
             bbox.setMaxX(bboxData[2]);
             bbox.setMaxY(bboxData[3]);
         }
+
+        archive & constrained;
+        archive & exteriorParity;
+        std::vector<double> segmentData;
+        if (Archive::is_saving::value)
+        {
+            segmentData = flattenSegments(constraints);
+        }
+        archive & segmentData;
+        if (Archive::is_loading::value)
+        {
+            constraints = unflattenSegments(segmentData);
+            applyConstraints();
+        }
+
+        // custom indices don't survive the archive, heights travel as x y z (see HeightTable::exportVertices)
+        std::vector<double> heightData;
+        if (Archive::is_saving::value && !heights.empty())
+        {
+            heightData = heights.exportVertices(mesh);
+        }
+        archive & heightData;
+        if (Archive::is_loading::value)
+        {
+            heights.importVertices(mesh, heightData);
+        }
+        archive & samples;
     }
 };
 
+/*
+Halo area of a cols x rows grid of equal blocks over domain with halo width 2r: every cut
+between two blocks is covered 2r deep from both sides. Cuts on the domain edge exchange nothing.
+*/
+double gridHaloArea(int cols, int rows, const Bbox2 &domain, double r)
+{
+    return 2 * 2 * r * ((cols - 1) * domain.getRangeY() + (rows - 1) * domain.getRangeX());
+}
+
+/*
+Factorization cols x rows = numBlocks with the least halo area (see gridHaloArea) on domain,
+so an elongated domain is cut across its long side and a prime count gives a single row or column.
+*/
+void chooseGridShape(int numBlocks, const Bbox2 &domain, double r, int &cols, int &rows)
+{
+    cols = numBlocks;
+    rows = 1;
+    for (int c = 1; c <= numBlocks; ++c)
+    {
+        if (numBlocks % c == 0 && gridHaloArea(c, numBlocks / c, domain, r) < gridHaloArea(cols, rows, domain, r))
+        {
+            cols = c;
+            rows = numBlocks / c;
+        }
+    }
+}
+
 struct GlobalMesh
 {
     Fade_2D mesh;
 
-    MeshGenParams initMeshGenParams; // params for initial sequential refinement
     std::string inFilePath, outFilePath;
     int numProcessors;
 
+    // all boundary segments (outer polygons and holes) as given by the input
+    std::vector<Segment2> boundarySegments;
+
+    // block layout of the last layoutBlocks, nodeCols x nodeRows node regions of equal sub-grids,
+    // and the boundary pieces of the blocks not yet built
+    BlockGrid grid;
+    int nodeCols = 1, nodeRows = 1;
+    ClippedBoundary boundary;
+
+    // corners of the refined triangles collected from the blocks for the output (3 per triangle)
+    std::vector<Point2> mergedCorners;
+
+    InsertionOrder insertionOrder;
+    InsertionStats insertionStats;
+
+    // heights of the terrain samples (empty if the input is not a terrain)
+    HeightTable heights;
+
     GlobalMesh(RuntimeParameters params)
     {
         inFilePath = params.inFilePath;
         outFilePath = params.outFilePath;
         numProcessors = params.numProcessors;
+        insertionOrder = parseInsertionOrder(params.insertionOrder);
+    }
+
+    /*
+    Sequentially pre-refine the entire mesh to initialAngleDegrees, which removes the slivers
+    along the hull whose circumradii would otherwise set the halo width (see computeMaxCircumradius).
+    The parallel phases refine to the full minAngleDegrees. A terrain is left as sampled:
+    its samples are dense already and Steiner points here would have no heights.
+    */
+    void refineMesh()
+    {
+        std::vector<Triangle2 *> triangles;
+        mesh.getTrianglePointers(triangles);
+        if (triangles.empty() || !heights.empty())
+        {
+            return;
+        }
+        Zone2 *zone = mesh.createZone(triangles, false);
+        Zone2 *boundedZone = zone->convertToBoundedZone();
+        mesh.refine(boundedZone, initialAngleDegrees, 0, std::numeric_limits<double>::max(), true);
+        mesh.deleteZone(boundedZone);
+        mesh.deleteZone(zone);
+    }
+
+    /*
+    Insert the input points (a .ply point cloud, see readPointsPLY) of inFilePath.
+    */
+    bool loadPoints()
+    {
+        std::vector<Point2> points;
+        if (!readPointsPLY(inFilePath.c_str(), true, points))
+        {
+            std::cout << "Can't read points " << inFilePath << std::endl;
+            return false;
+        }
+        bulkInsert(mesh, points, insertionOrder, &insertionStats);
+        std::cout << "Points " << points.size() << " from " << inFilePath << std::endl;
+        return true;
+    }
+
+    /*
+    Add the polygons of a boundary file (see readPolygons) to the domain boundary.
+    */
+    bool loadBoundary(const std::string &path)
+    {
+        std::vector<std::vector<Segment2>> polygons;
+        if (!readPolygons(path, polygons))
+        {
+            return false;
+        }
+        for (auto &polygon : polygons)
+        {
+            addBoundary(polygon);
+        }
+        std::cout << "Boundary " << polygons.size() << " polygons from " << path << std::endl;
+        return true;
+    }
+
+    /*
+    Insert the terrain samples of an "x y z" file (see readTerrain) with their heights.
+    */
+    bool loadTerrain(const std::string &path)
+    {
+        std::vector<Point2> points;
+        if (!readTerrain(path, points, heights))
+        {
+            return false;
+        }
+        heights.bind(points, bulkInsert(mesh, points, insertionOrder, &insertionStats));
+        std::cout << "Terrain " << points.size() << " samples from " << path << std::endl;
+        return true;
     }
 
     /*
-    Sequentially refine the entire mesh.
-    * seq delaunay refinement on page 1912
+    Add a closed polygon to the domain boundary, either an outer boundary or a hole.
+    Nested polygons alternate between domain and hole (even-odd rule).
     */
-    Fade_2D refineMesh()
+    void addBoundary(std::vector<Segment2> &polygon)
     {
-        std::vector<Point2 *> vectors = mesh.getVertexPointers();
-        Fade_2D Q;
-        for (Point2 p : vectors)
+        mesh.createConstraint(polygon, CIS_CONSTRAINED_DELAUNAY);
+        boundarySegments.insert(boundarySegments.end(), polygon.begin(), polygon.end());
+    }
+
+    /*
+    Largest circumradius over all triangles of the (pre-refined) mesh.
+    Defines the width of the buffer zones between blocks.
+    */
+    double computeMaxCircumradius()
+    {
+        std::vector<Triangle2 *> triangles;
+        mesh.getTrianglePointers(triangles);
+        double maxRadius = 0;
+        for (auto &triangle : triangles)
         {
-            // should test some upper/lower bound from initMeshGenParams
-            if (true)
+            CircumcenterQuality ccq;
+            Point2 center = triangle->getCircumcenter(ccq);
+            maxRadius = std::max(maxRadius, std::sqrt(sqDistance2D(center, *triangle->getCorner(0))));
+        }
+        return maxRadius;
+    }
+
+    /*
+    Lay out the block grid for nproc blocks without building any of them (see fillBlock).
+    Blocks form a cols x rows grid (see chooseGridShape), block = row * cols + col, row 0 on the minY side (Top).
+    With numNodes > 1 the grid is two-level: the domain is first cut into nodeCols x nodeRows
+    node regions with the least halo area between nodes, then every node region into the same
+    sub-grid of nproc / numNodes blocks (see assignBlocksToNodes for the matching ranks).
+    */
+    void layoutBlocks(int nproc, int numNodes = 1)
+    {
+        Bbox2 domain = mesh.computeBoundingBox();
+        double r = computeMaxCircumradius();
+        int cols, rows;
+        nodeCols = nodeRows = 1;
+        if (numNodes > 1 && nproc % numNodes == 0)
+        {
+            chooseGridShape(numNodes, domain, r, nodeCols, nodeRows);
+            Bbox2 nodeRegion;
+            nodeRegion.add(Point2(0, 0));
+            nodeRegion.add(Point2(domain.getRangeX() / nodeCols, domain.getRangeY() / nodeRows));
+            int innerCols, innerRows;
+            chooseGridShape(nproc / numNodes, nodeRegion, r, innerCols, innerRows);
+            cols = nodeCols * innerCols;
+            rows = nodeRows * innerRows;
+            std::cout << "Nodes " << nodeCols << " x " << nodeRows << ", halo area between nodes "
+                      << gridHaloArea(nodeCols, nodeRows, domain, r) << std::endl;
+        }
+        else
+        {
+            chooseGridShape(nproc, domain, r, cols, rows);
+        }
+        std::cout << "Grid " << cols << " x " << rows << " blocks of " << domain.getRangeX() / cols << " x " << domain.getRangeY() / rows
+                  << ", halo area " << gridHaloArea(cols, rows, domain, r) << std::endl;
+
+        grid = BlockGrid();
+        for (int i = 0; i <= cols; ++i)
+        {
+            grid.xEdges.push_back(domain.get_minX() + domain.getRangeX() * i / cols);
+        }
+        for (int i = 0; i <= rows; ++i)
+        {
+            grid.yEdges.push_back(domain.get_minY() + domain.getRangeY() * i / rows);
+        }
+        grid.r = r;
+
+        // assign all boundary pieces to their blocks in one bulk pass before any block is built
+        boundary = clipToBlocks(boundarySegments, grid, std::thread::hardware_concurrency());
+    }
+
+    /*
+    Build block `block` of the last layoutBlocks in place: the points and boundary pieces of
+    the block plus a 2r halo, its bbox and its neighbors (as block numbers).
+    LocalMesh can't be copied or moved (Fade_2D), so the caller owns the object it is built in
+    and every block is built exactly once.
+    */
+    void fillBlock(size_t block, LocalMesh &localMesh)
+    {
+        int cols = grid.cols(), rows = grid.rows();
+        int row = int(block) / cols, col = int(block) % cols;
+        localMesh.bbox = grid.block(row, col);
+        localMesh.maxCircumradius = grid.r;
+        localMesh.setGridNeighbors(row, col, cols, rows);
+
+        std::vector<Point2 *> vertices;
+        mesh.getVertexPointers(vertices);
+        Bbox2 halo = grid.halo(row, col);
+        std::vector<Point2> haloPoints;
+        for (auto &vertex : vertices)
+        {
+            if (halo.isInBox(*vertex))
             {
-                Point2 *point = Q.insert(p) // get pointer back to where in triangle
+                haloPoints.push_back(*vertex);
+                // the copy carries the global slot, give it one in the local table
+                haloPoints.back().setCustomIndex(-1);
+                if (heights.has(*vertex))
+                {
+                    localMesh.heights.assign(haloPoints.back(), heights.at(*vertex));
+                    localMesh.samples.insert(localMesh.samples.end(), {vertex->x(), vertex->y(), heights.at(*vertex)});
+                }
             }
         }
-        std::vector<Point2 *> points = Q.getVertexPointers();
-        while (points.size())
+        localMesh.insertionOrder = insertionOrder;
+        localMesh.heights.bind(haloPoints, bulkInsert(localMesh.mesh, haloPoints, insertionOrder, &insertionStats));
+
+        localMesh.constrained = !boundarySegments.empty();
+        localMesh.constraints = std::move(boundary.pieces[block]);
+        localMesh.exteriorParity = std::move(boundary.parities[block]);
+        localMesh.applyConstraints();
+    }
+
+    /*
+    Given the number of processors, split the mesh into nproc localMeshes, all in memory at once
+    (see layoutBlocks and fillBlock). The meshes are built in place in the returned vector.
+    */
+    std::vector<LocalMesh> splitMesh(int nproc, int numNodes = 1)
+    {
+        layoutBlocks(nproc, numNodes);
+        std::vector<LocalMesh> meshes(nproc);
+        for (size_t block = 0; block < meshes.size(); ++block)
         {
-            // t \in Q
-            Point2 t = points[0];
-            // i think it also splits so there wouldnt be segments encroached?
-            // this should be those within circumradius not incident persay
-            std::vector<Point2 *> cm_v = mesh.getIncidentTriangles();
+            fillBlock(block, meshes[block]);
+        }
+        return meshes;
+    }
 
-            for (Point2 p : cm_v)
-            { // remove b_m too dont know how to get this
-                mesh = mesh.remove(p)
+    /*
+    Add the refined triangles of localMesh to the output: the domain triangles it owns, so
+    every triangle of the recombined mesh is taken from exactly one block (see saveToPLY).
+    */
+    void loadFromLocalMesh(LocalMesh &localMesh)
+    {
+        std::vector<Triangle2 *> triangles;
+        localMesh.mesh.getTrianglePointers(triangles);
+        for (auto &triangle : triangles)
+        {
+            Point2 barycenter = triangle->getBarycenter();
+            if (ownsPoint(localMesh.bbox, barycenter) && localMesh.isInsideDomain(barycenter))
+            {
+                for (int corner = 0; corner < 3; ++corner)
+                {
+                    mergedCorners.push_back(*triangle->getCorner(corner));
+                }
             }
         }
     }
 
     /*
-    Given the number of processors, split the mesh and create a localMesh object.
-    Populates all the fields (depending on if initZones is true, populate the zones)
-    Return a vector of localMeshes of length nproc.
+    Combine a list of localMeshes, e.g. all cells of the threaded backend.
     */
-    std::vector<LocalMesh> splitMesh(int nproc, bool initZones)
+    void loadFromLocalMeshes(std::vector<LocalMesh> &localMeshes)
     {
-        std::vector<LocalMesh *> meshes(nproc); // not done
+        for (auto &localMesh : localMeshes)
+        {
+            loadFromLocalMesh(localMesh);
+        }
     }
 
     /*
-    Delete the current mesh and reconstruct one by combining a list of localMeshes.
-    Used to combine results as the end of computation.
+    Save mesh to a binary mesh file (see meshio.hpp).
+    With withBlocks the file gets one block per block of the last layoutBlocks, each with
+    the triangles of its 2r halo, so every rank can later map only its own region
+    (see LocalMesh::loadFromBinary).
     */
-    void loadFromLocalMeshes(std::vector<LocalMesh> localMeshes)
+    bool saveToBinary(const std::string &path, bool withBlocks)
     {
-        SerializableMesh recombine;
-        for (LocalMesh local : localMeshes)
+        std::vector<MeshBlock> blocks;
+        if (withBlocks && grid.cols() > 0)
         {
-            recombine
+            for (int row = 0; row < grid.rows(); ++row)
+            {
+                for (int col = 0; col < grid.cols(); ++col)
+                {
+                    blocks.push_back(extractBlock(mesh, grid.halo(row, col)));
+                    blocks.back().bbox = grid.block(row, col);
+                }
+            }
         }
+        else
+        {
+            blocks.push_back(extractBlock(mesh, Bbox2()));
+            withBlocks = false;
+        }
+        return writeMeshFile(path, blocks, withBlocks);
     }
 
     /*
-    Save mesh to .ply file (file name specified by runtimeParameters)
-    using writePointsPLY().
+    Load a previously refined mesh from a binary mesh file, replacing the current one.
+    The triangles are imported as stored, no re-triangulation of the points.
+    With a block table the halos overlap: take every triangle from the block owning its barycenter.
     */
-    void saveToPLY()
+    bool loadFromBinary(const std::string &path)
     {
-        writePointsPLY(inFilePath, mesh, outFilePath)
+        MappedMesh mapped;
+        if (!mapped.open(path))
+        {
+            return false;
+        }
+        mesh.reset();
+        if (mapped.importTriangles(mesh) == NULL)
+        {
+            return false;
+        }
+        std::cout << "Mesh " << mesh.numberOfTriangles() << " triangles from " << path << std::endl;
+        return true;
+    }
+
+    /*
+    Save the triangles collected by loadFromLocalMesh to .ply file (file name specified by runtimeParameters),
+    see writeTrianglesPly.
+    */
+    bool saveToPLY()
+    {
+        return writeTrianglesPly(mergedCorners, outFilePath);
     }
 };
 
@@ -324,7 +1388,8 @@ enum class Operation
 {
     Send,
     Receive,
-    Refine
+    Refine,
+    Smooth // in place of Refine, see smoothingSchedule
 };
 
 struct Task
@@ -552,7 +1617,7 @@ std::vector<TaskGroup> initializeTaskGroups()
             bbox.setMaxY(b->get_minY() + 2 * r);
             return bbox; })};
     phaseFourTasks.refineTask =
-        Task(Operation::Refine, [](Bbox2 *b, double r)
+        Task(Operation::Refine, [](Bbox2 *b, double /* r */)
              { 
             Bbox2 bbox = Bbox2();
             bbox.setMinX(b->get_minX());
@@ -564,3 +1629,21 @@ std::vector<TaskGroup> initializeTaskGroups()
     std::vector<TaskGroup> taskGroups = {phaseZeroTasks, phaseOneTasks, phaseTwoTasks, phaseThreeTasks, phaseFourTasks};
     return taskGroups;
 }
+
+/*
+The schedule with every refinement replaced by smoothing of the same box: a vertex only
+moves in the one block that owns the box in that phase, and the halos of the phase carry
+its new position to the neighbors, as they carry new vertices during refinement.
+*/
+std::vector<TaskGroup> smoothingSchedule(const std::vector<TaskGroup> &taskGroups)
+{
+    std::vector<TaskGroup> smoothingGroups = taskGroups;
+    for (auto &taskGroup : smoothingGroups)
+    {
+        if (taskGroup.refineTask.has_value())
+        {
+            taskGroup.refineTask.value().operation = Operation::Smooth;
+        }
+    }
+    return smoothingGroups;
+}
@@ -0,0 +1,661 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <Fade_2D.h>
+
+#include "insertion.hpp"
+#include "constraint.hpp"
+
+using namespace GEOM_FADE2D;
+
+// BINARY IO
+
+template <class T>
+void writeBinary(std::ostream &stream, const T &value)
+{
+    stream.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <class T>
+bool readBinary(std::istream &stream, T &value)
+{
+    return bool(stream.read(reinterpret_cast<char *>(&value), sizeof(T)));
+}
+
+void writeDoubles(std::ostream &stream, const std::vector<double> &values)
+{
+    writeBinary(stream, uint64_t(values.size()));
+    stream.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(double));
+}
+
+bool readDoubles(std::istream &stream, std::vector<double> &values)
+{
+    uint64_t size;
+    if (!readBinary(stream, size))
+    {
+        return false;
+    }
+    values.resize(size);
+    return bool(stream.read(reinterpret_cast<char *>(values.data()), size * sizeof(double)));
+}
+
+// BINARY MESH FILE
+
+/*
+Versioned, mmap-able container for a refined mesh. Native endianness (checked via byteOrder).
+
+    MeshFileHeader
+    MeshFileBlock[numBlocks]          optional block table, numBlocks == 0 if absent
+    double  x[numPoints]              structure of arrays coordinates
+    double  y[numPoints]
+    int32   triangles[3 * numTriangles]  counterclockwise vertex indices (as in FadeExport)
+    int32   neighbors[3 * numTriangles]  triangle opposite to corner i, -1 if none
+
+Every section starts at a 64 byte boundary. With a block table the points and triangles are
+grouped by block and a block's triangles only reference the points of its own range (vertices
+on a seam are stored once per block), so one block can be mapped and used on its own.
+Blocks are stored in row-major grid order; a block's entry holds the region it owns, its
+triangles may reach beyond (GlobalMesh::saveToBinary stores the halo with every block).
+*/
+
+const char meshFileMagic[8] = "DMRMESH";
+const uint32_t meshFileVersion = 1;
+const uint32_t meshFileByteOrder = 0x01020304;
+
+struct MeshFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t numPoints;
+    uint64_t numTriangles;
+    uint64_t numBlocks;
+    uint64_t xOffset, yOffset, triangleOffset, neighborOffset, blockTableOffset; // byte offsets of the sections
+};
+
+struct MeshFileBlock
+{
+    double minX, minY, maxX, maxY;
+    uint64_t firstPoint, numPoints;
+    uint64_t firstTriangle, numTriangles;
+};
+
+/*
+One block of a mesh, with block-local indices, as collected before writing.
+*/
+struct MeshBlock
+{
+    Bbox2 bbox;
+    std::vector<double> x, y;
+    std::vector<int32_t> triangles, neighbors;
+};
+
+/*
+Collect the triangles of mesh whose barycenter lies in bbox (half-open, see ownsPoint; all
+triangles if bbox is invalid), their vertices and the neighborships between them.
+*/
+MeshBlock extractBlock(Fade_2D &mesh, const Bbox2 &bbox)
+{
+    MeshBlock block;
+    block.bbox = bbox;
+
+    std::vector<Triangle2 *> allTriangles, triangles;
+    mesh.getTrianglePointers(allTriangles);
+    for (auto &triangle : allTriangles)
+    {
+        if (!bbox.isValid() || ownsPoint(bbox, triangle->getBarycenter()))
+        {
+            triangles.push_back(triangle);
+        }
+    }
+
+    std::unordered_map<Triangle2 *, int32_t> triangleIndex;
+    std::unordered_map<Point2 *, int32_t> pointIndex;
+    triangleIndex.reserve(triangles.size());
+    for (auto &triangle : triangles)
+    {
+        triangleIndex.emplace(triangle, int32_t(triangleIndex.size()));
+    }
+
+    block.triangles.reserve(3 * triangles.size());
+    block.neighbors.reserve(3 * triangles.size());
+    for (auto &triangle : triangles)
+    {
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            Point2 *vertex = triangle->getCorner(corner);
+            auto inserted = pointIndex.emplace(vertex, int32_t(block.x.size()));
+            if (inserted.second)
+            {
+                block.x.push_back(vertex->x());
+                block.y.push_back(vertex->y());
+            }
+            block.triangles.push_back(inserted.first->second);
+
+            auto neighbor = triangleIndex.find(triangle->getOppositeTriangle(corner));
+            block.neighbors.push_back(neighbor == triangleIndex.end() ? -1 : neighbor->second);
+        }
+    }
+    return block;
+}
+
+uint64_t alignSection(uint64_t offset)
+{
+    return (offset + 63) / 64 * 64;
+}
+
+/*
+Write blocks into one mesh file. withBlockTable=false writes a plain mesh
+(meaningful for a single block, e.g. extractBlock(mesh, Bbox2())).
+*/
+bool writeMeshFile(const std::string &path, const std::vector<MeshBlock> &blocks, bool withBlockTable)
+{
+    MeshFileHeader header = {};
+    std::copy(meshFileMagic, meshFileMagic + sizeof(meshFileMagic), header.magic);
+    header.version = meshFileVersion;
+    header.byteOrder = meshFileByteOrder;
+
+    std::vector<MeshFileBlock> table;
+    for (auto &block : blocks)
+    {
+        MeshFileBlock entry = {block.bbox.get_minX(), block.bbox.get_minY(), block.bbox.get_maxX(), block.bbox.get_maxY(),
+                               header.numPoints, block.x.size(), header.numTriangles, block.triangles.size() / 3};
+        table.push_back(entry);
+        header.numPoints += block.x.size();
+        header.numTriangles += block.triangles.size() / 3;
+    }
+    if (header.numPoints > uint64_t(INT32_MAX) || header.numTriangles > uint64_t(INT32_MAX))
+    {
+        std::cout << "Mesh too large for 32 bit indices, can't write " << path << std::endl;
+        return false;
+    }
+
+    header.numBlocks = withBlockTable ? blocks.size() : 0;
+    header.blockTableOffset = alignSection(sizeof(MeshFileHeader));
+    header.xOffset = alignSection(header.blockTableOffset + header.numBlocks * sizeof(MeshFileBlock));
+    header.yOffset = alignSection(header.xOffset + header.numPoints * sizeof(double));
+    header.triangleOffset = alignSection(header.yOffset + header.numPoints * sizeof(double));
+    header.neighborOffset = alignSection(header.triangleOffset + 3 * header.numTriangles * sizeof(int32_t));
+
+    std::ofstream stream(path, std::ios::binary);
+    if (!stream.is_open())
+    {
+        std::cout << "Can't write " << path << std::endl;
+        return false;
+    }
+    auto padTo = [&](uint64_t offset)
+    {
+        while (uint64_t(stream.tellp()) < offset)
+        {
+            stream.put(0);
+        }
+    };
+
+    writeBinary(stream, header);
+    padTo(header.blockTableOffset);
+    if (withBlockTable)
+    {
+        stream.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(MeshFileBlock));
+    }
+
+    padTo(header.xOffset);
+    for (auto &block : blocks)
+    {
+        stream.write(reinterpret_cast<const char *>(block.x.data()), block.x.size() * sizeof(double));
+    }
+    padTo(header.yOffset);
+    for (auto &block : blocks)
+    {
+        stream.write(reinterpret_cast<const char *>(block.y.data()), block.y.size() * sizeof(double));
+    }
+
+    // block-local indices become file-global indices
+    padTo(header.triangleOffset);
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        std::vector<int32_t> triangles(blocks[i].triangles);
+        for (auto &index : triangles)
+        {
+            index += int32_t(table[i].firstPoint);
+        }
+        stream.write(reinterpret_cast<const char *>(triangles.data()), triangles.size() * sizeof(int32_t));
+    }
+    padTo(header.neighborOffset);
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        std::vector<int32_t> neighbors(blocks[i].neighbors);
+        for (auto &index : neighbors)
+        {
+            if (index >= 0) index += int32_t(table[i].firstTriangle);
+        }
+        stream.write(reinterpret_cast<const char *>(neighbors.data()), neighbors.size() * sizeof(int32_t));
+    }
+
+    stream.close();
+    return bool(stream);
+}
+
+/*
+Write an indexed triangle mesh as a binary little endian PLY file with 32 bit unsigned
+indices: coordinates x0, y0, x1, y1, ..., heights z0, z1, ... or empty (z = 0), triangles
+three vertex indices each, all in the given order.
+*/
+bool writePly(const std::vector<double> &coordinates, const std::vector<double> &heights, const std::vector<uint32_t> &triangles,
+              const std::string &path)
+{
+    size_t numPoints = coordinates.size() / 2;
+    if (numPoints > uint64_t(UINT32_MAX) + 1)
+    {
+        std::cout << "Mesh too large for 32 bit indices, can't write " << path << std::endl;
+        return false;
+    }
+    std::ofstream stream(path, std::ios::binary);
+    if (!stream.is_open())
+    {
+        std::cout << "Can't write " << path << std::endl;
+        return false;
+    }
+    stream << "ply\nformat binary_little_endian 1.0\n"
+           << "element vertex " << numPoints << "\n"
+           << "property double x\nproperty double y\nproperty double z\n"
+           << "element face " << triangles.size() / 3 << "\n"
+           << "property list uchar uint vertex_indices\nend_header\n";
+
+    for (size_t i = 0; i < numPoints; ++i)
+    {
+        writeBinary(stream, coordinates[2 * i]);
+        writeBinary(stream, coordinates[2 * i + 1]);
+        writeBinary(stream, heights.empty() ? 0.0 : heights[i]);
+    }
+    for (size_t t = 0; t + 2 < triangles.size(); t += 3)
+    {
+        writeBinary(stream, uint8_t(3));
+        stream.write(reinterpret_cast<const char *>(triangles.data() + t), 3 * sizeof(uint32_t));
+    }
+    stream.close();
+    return bool(stream);
+}
+
+/*
+Write triangles given as corner triples (3 points per triangle, counterclockwise) as a binary
+little endian PLY file (z = 0), every vertex once: corners at the same position share an index.
+*/
+bool writeTrianglesPly(const std::vector<Point2> &corners, const std::string &path)
+{
+    // corners sorted by position, equal positions become one vertex
+    std::vector<size_t> order(corners.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+              { return corners[a].x() < corners[b].x() || (corners[a].x() == corners[b].x() && corners[a].y() < corners[b].y()); });
+    std::vector<const Point2 *> vertices;
+    std::vector<uint32_t> indices(corners.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        const Point2 &corner = corners[order[i]];
+        if (vertices.empty() || corner.x() != vertices.back()->x() || corner.y() != vertices.back()->y())
+        {
+            if (vertices.size() > uint64_t(UINT32_MAX))
+            {
+                std::cout << "Mesh too large for 32 bit indices, can't write " << path << std::endl;
+                return false;
+            }
+            vertices.push_back(&corner);
+        }
+        indices[order[i]] = uint32_t(vertices.size() - 1);
+    }
+
+    std::ofstream stream(path, std::ios::binary);
+    if (!stream.is_open())
+    {
+        std::cout << "Can't write " << path << std::endl;
+        return false;
+    }
+    stream << "ply\nformat binary_little_endian 1.0\n"
+           << "element vertex " << vertices.size() << "\n"
+           << "property double x\nproperty double y\nproperty double z\n"
+           << "element face " << indices.size() / 3 << "\n"
+           << "property list uchar uint vertex_indices\nend_header\n";
+    for (auto &vertex : vertices)
+    {
+        writeBinary(stream, vertex->x());
+        writeBinary(stream, vertex->y());
+        writeBinary(stream, 0.0);
+    }
+    for (size_t t = 0; t + 2 < indices.size(); t += 3)
+    {
+        writeBinary(stream, uint8_t(3));
+        stream.write(reinterpret_cast<const char *>(indices.data() + t), 3 * sizeof(uint32_t));
+    }
+    stream.close();
+    return bool(stream);
+}
+
+/*
+Read-only memory mapping of a mesh file, either the whole file or a single block.
+The arrays point directly into the mapping. Indices in triangles and neighbors are
+file-global, subtract pointBase / triangleBase to index x, y and triangles.
+*/
+class MappedMesh
+{
+public:
+    MeshFileHeader header;
+    std::vector<MeshFileBlock> blocks;
+
+    const double *x = nullptr;
+    const double *y = nullptr;
+    const int32_t *triangles = nullptr;
+    const int32_t *neighbors = nullptr;
+    uint64_t numPoints = 0, numTriangles = 0;
+    uint64_t pointBase = 0, triangleBase = 0;
+
+    MappedMesh() {}
+    MappedMesh(const MappedMesh &) = delete;
+    MappedMesh &operator=(const MappedMesh &) = delete;
+
+    ~MappedMesh()
+    {
+        close();
+    }
+
+    /*
+    Map the whole mesh.
+    */
+    bool open(const std::string &path)
+    {
+        if (!openFile(path))
+        {
+            return false;
+        }
+        numPoints = header.numPoints;
+        numTriangles = header.numTriangles;
+        return mapArrays();
+    }
+
+    /*
+    Map only the points and triangles of one block of the block table.
+    */
+    bool openBlock(const std::string &path, size_t block)
+    {
+        if (!openFile(path))
+        {
+            return false;
+        }
+        if (block >= header.numBlocks)
+        {
+            std::cout << path << " has no block " << block << std::endl;
+            close();
+            return false;
+        }
+        pointBase = blocks[block].firstPoint;
+        numPoints = blocks[block].numPoints;
+        triangleBase = blocks[block].firstTriangle;
+        numTriangles = blocks[block].numTriangles;
+        return mapArrays();
+    }
+
+    /*
+    Read and check only the header and the block table, nothing is mapped.
+    */
+    bool openFile(const std::string &path)
+    {
+        close();
+        fd = ::open(path.c_str(), O_RDONLY);
+        struct stat status;
+        if (fd < 0 || fstat(fd, &status) != 0 || pread(fd, &header, sizeof(header), 0) != ssize_t(sizeof(header)) ||
+            std::string(header.magic, sizeof(header.magic)) != std::string(meshFileMagic, sizeof(meshFileMagic)) ||
+            header.version != meshFileVersion || header.byteOrder != meshFileByteOrder)
+        {
+            std::cout << "Can't read mesh file " << path << std::endl;
+            close();
+            return false;
+        }
+        fileSize = uint64_t(status.st_size);
+
+        // a truncated or corrupt file must fail here, not as SIGBUS or an out-of-bounds read later
+        if (!fits(header.xOffset, header.numPoints, sizeof(double)) || !fits(header.yOffset, header.numPoints, sizeof(double)) ||
+            !fits(header.triangleOffset, header.numTriangles, 3 * sizeof(int32_t)) ||
+            !fits(header.neighborOffset, header.numTriangles, 3 * sizeof(int32_t)) ||
+            !fits(header.blockTableOffset, header.numBlocks, sizeof(MeshFileBlock)))
+        {
+            std::cout << "Truncated mesh file " << path << std::endl;
+            close();
+            return false;
+        }
+
+        blocks.resize(header.numBlocks);
+        size_t tableBytes = blocks.size() * sizeof(MeshFileBlock);
+        if (pread(fd, blocks.data(), tableBytes, header.blockTableOffset) != ssize_t(tableBytes))
+        {
+            std::cout << "Truncated block table in " << path << std::endl;
+            close();
+            return false;
+        }
+        for (auto &block : blocks)
+        {
+            if (block.firstPoint > header.numPoints || block.numPoints > header.numPoints - block.firstPoint ||
+                block.firstTriangle > header.numTriangles || block.numTriangles > header.numTriangles - block.firstTriangle)
+            {
+                std::cout << "Corrupt block table in " << path << std::endl;
+                close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void close()
+    {
+        for (auto &mapping : mappings)
+        {
+            munmap(mapping.first, mapping.second);
+        }
+        mappings.clear();
+        if (fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    /*
+    Columns of the block grid: the blocks of the first row share its minY.
+    */
+    int gridCols() const
+    {
+        int cols = 0;
+        while (size_t(cols) < blocks.size() && blocks[cols].minY == blocks.front().minY)
+        {
+            cols += 1;
+        }
+        return cols;
+    }
+
+    /*
+    The block grid the block table was saved from (edges of its first row and column, halo
+    width unknown), e.g. to deal the blocks to ranks with assignBlocks.
+    */
+    BlockGrid blockGrid() const
+    {
+        BlockGrid grid;
+        int cols = gridCols();
+        if (cols == 0)
+        {
+            return grid;
+        }
+        for (int col = 0; col < cols; ++col)
+        {
+            grid.xEdges.push_back(blocks[col].minX);
+        }
+        for (size_t block = 0; block < blocks.size(); block += cols)
+        {
+            grid.yEdges.push_back(blocks[block].minY);
+        }
+        grid.xEdges.push_back(blocks[cols - 1].maxX);
+        grid.yEdges.push_back(blocks.back().maxY);
+        return grid;
+    }
+
+    /*
+    Largest circumradius of the mapped triangles (the halo width a block was saved with).
+    */
+    double maxCircumradius() const
+    {
+        double maxRadius = 0;
+        for (uint64_t t = 0; t < numTriangles; ++t)
+        {
+            double px[3], py[3];
+            for (int corner = 0; corner < 3; ++corner)
+            {
+                px[corner] = x[triangles[3 * t + corner] - pointBase];
+                py[corner] = y[triangles[3 * t + corner] - pointBase];
+            }
+            double a = std::hypot(px[1] - px[0], py[1] - py[0]);
+            double b = std::hypot(px[2] - px[1], py[2] - py[1]);
+            double c = std::hypot(px[0] - px[2], py[0] - py[2]);
+            double area = std::fabs((px[1] - px[0]) * (py[2] - py[0]) - (px[2] - px[0]) * (py[1] - py[0])) / 2;
+            if (area > 0)
+            {
+                maxRadius = std::max(maxRadius, a * b * c / (4 * area));
+            }
+        }
+        return maxRadius;
+    }
+
+    /*
+    Bulk insert the mapped points into mesh (Delaunay triangulation of the vertices).
+    */
+    void insertPoints(Fade_2D &mesh, InsertionOrder order, InsertionStats *stats = nullptr) const
+    {
+        std::vector<Point2> points;
+        points.reserve(numPoints);
+        for (uint64_t i = 0; i < numPoints; ++i)
+        {
+            points.push_back(Point2(x[i], y[i]));
+        }
+        bulkInsert(mesh, points, order, stats);
+    }
+
+    /*
+    Import the mapped triangles into an empty mesh, reproducing the stored triangulation exactly.
+    The blocks of a whole mapped file overlap by their halos: every triangle is then taken
+    from the block owning its barycenter (see ownsPoint) only.
+    */
+    Zone2 *importTriangles(Fade_2D &mesh) const
+    {
+        std::vector<Point2> corners;
+        corners.reserve(3 * numTriangles);
+        auto addTriangles = [&](uint64_t first, uint64_t count, const MeshFileBlock *owner)
+        {
+            Bbox2 owned;
+            if (owner)
+            {
+                owned.setMinX(owner->minX);
+                owned.setMinY(owner->minY);
+                owned.setMaxX(owner->maxX);
+                owned.setMaxY(owner->maxY);
+            }
+            for (uint64_t t = first; t < first + count; ++t)
+            {
+                Point2 triangle[3];
+                for (int corner = 0; corner < 3; ++corner)
+                {
+                    uint64_t vertex = triangles[3 * t + corner] - pointBase;
+                    triangle[corner] = Point2(x[vertex], y[vertex]);
+                }
+                Point2 barycenter((triangle[0].x() + triangle[1].x() + triangle[2].x()) / 3,
+                                  (triangle[0].y() + triangle[1].y() + triangle[2].y()) / 3);
+                if (!owner || ownsPoint(owned, barycenter))
+                {
+                    corners.insert(corners.end(), triangle, triangle + 3);
+                }
+            }
+        };
+        if (triangleBase == 0 && numTriangles == header.numTriangles && !blocks.empty())
+        {
+            for (auto &block : blocks)
+            {
+                addTriangles(block.firstTriangle, block.numTriangles, &block);
+            }
+        }
+        else
+        {
+            addTriangles(0, numTriangles, nullptr);
+        }
+        return mesh.importTriangles(corners, false, false);
+    }
+
+private:
+    int fd = -1;
+    uint64_t fileSize = 0;
+    std::vector<std::pair<void *, size_t>> mappings;
+
+    /*
+    count elements of elementSize bytes at offset lie inside the file (overflow safe).
+    */
+    bool fits(uint64_t offset, uint64_t count, uint64_t elementSize) const
+    {
+        return offset <= fileSize && count <= (fileSize - offset) / elementSize;
+    }
+
+    /*
+    Map [offset, offset + length) of the file; mmap needs a page aligned start.
+    */
+    const char *mapRange(uint64_t offset, uint64_t length)
+    {
+        if (length == 0)
+        {
+            return nullptr;
+        }
+        uint64_t pageSize = sysconf(_SC_PAGESIZE);
+        uint64_t start = offset / pageSize * pageSize;
+        size_t size = length + (offset - start);
+        void *address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, start);
+        if (address == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        mappings.push_back({address, size});
+        return static_cast<const char *>(address) + (offset - start);
+    }
+
+    bool mapArrays()
+    {
+        // the ranges lie inside the sections and block table checked by openFile
+        x = reinterpret_cast<const double *>(mapRange(header.xOffset + pointBase * sizeof(double), numPoints * sizeof(double)));
+        y = reinterpret_cast<const double *>(mapRange(header.yOffset + pointBase * sizeof(double), numPoints * sizeof(double)));
+        triangles = reinterpret_cast<const int32_t *>(mapRange(header.triangleOffset + 3 * triangleBase * sizeof(int32_t), 3 * numTriangles * sizeof(int32_t)));
+        neighbors = reinterpret_cast<const int32_t *>(mapRange(header.neighborOffset + 3 * triangleBase * sizeof(int32_t), 3 * numTriangles * sizeof(int32_t)));
+        bool mapped = (numPoints == 0 || (x && y)) && (numTriangles == 0 || (triangles && neighbors));
+        if (!mapped)
+        {
+            std::cout << "Can't map mesh file" << std::endl;
+            close();
+            return false;
+        }
+
+        // triangles may only reference the mapped points
+        for (uint64_t i = 0; i < 3 * numTriangles; ++i)
+        {
+            if (triangles[i] < 0 || uint64_t(triangles[i]) < pointBase || uint64_t(triangles[i]) - pointBase >= numPoints)
+            {
+                std::cout << "Corrupt triangle in mesh file" << std::endl;
+                close();
+                return false;
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <list>
+
+#include "checkpoint.hpp"
+#include "halo.hpp"
+
+// OUT-OF-CORE
+
+/*
+Counters of a CellStore over a run.
+*/
+struct CellStoreStats
+{
+    size_t loads = 0;
+    size_t spills = 0;
+    size_t peakResident = 0;
+};
+
+/*
+Keeps at most capacity of the cells (blocks) of this rank in memory, the others on disk
+in the checkpoint format (vertices, alive constraint pieces, heights and terrain samples, see checkpoint.hpp) as
+<dir>/rank<r>.cell<c>.ckpt. A cell that is not resident keeps everything but its
+triangulation: bbox, neighbors, statistics and its phase arena (so halos it sent in this
+phase stay valid). acquire makes a cell resident and spills the least recently used one.
+All of them return false (and leave the cell as it was) if a cell file can't be written or read.
+*/
+class CellStore
+{
+private:
+    std::vector<LocalMesh> &cells;
+    std::string dir;
+    int rank, nproc;
+    size_t capacity;
+    std::vector<bool> resident;
+    std::list<size_t> recent; // resident cells, most recently used first
+
+    std::string cellPath(size_t cell) const
+    {
+        return dir + "/rank" + std::to_string(rank) + ".cell" + std::to_string(cell) + ".ckpt";
+    }
+
+    void release(size_t cell)
+    {
+        LocalMesh &localMesh = cells[cell];
+        localMesh.mesh.reset();
+        localMesh.mesh.constraintSegments.clear();
+        localMesh.snapshot.release();
+        localMesh.heights = HeightTable();
+        localMesh.samples = std::vector<double>();
+        localMesh.arena.releaseScratch();
+        resident[cell] = false;
+        recent.remove(cell);
+    }
+
+public:
+    CellStoreStats stats;
+
+    // cell files carry this instead of a phase
+    static constexpr int cellPhase = -1;
+
+    CellStore(std::vector<LocalMesh> &cells, const std::string &dir, int rank, int nproc, size_t capacity)
+        : cells(cells), dir(dir), rank(rank), nproc(nproc), capacity(std::max<size_t>(capacity, 1)), resident(cells.size(), false) {}
+
+    size_t size() const
+    {
+        return cells.size();
+    }
+
+    LocalMesh &cell(size_t cell)
+    {
+        return cells[cell];
+    }
+
+    /*
+    Mark a cell that was just filled in memory (e.g. loaded from its block of a mesh file) as
+    resident, spilling the least recently used ones beyond capacity.
+    */
+    bool admit(size_t cell)
+    {
+        resident[cell] = true;
+        recent.push_front(cell);
+        stats.peakResident = std::max(stats.peakResident, recent.size());
+        while (recent.size() > capacity)
+        {
+            if (!spill(recent.back()))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /*
+    Write cell to disk and free its triangulation.
+    */
+    bool spill(size_t cell)
+    {
+        if (!resident[cell])
+        {
+            return true;
+        }
+        if (!saveCheckpoint(cells[cell], cellPath(cell), cellPhase, rank, nproc))
+        {
+            return false;
+        }
+        release(cell);
+        stats.spills += 1;
+        return true;
+    }
+
+    /*
+    Make cell resident (cells[cell] then holds its triangulation), reading it back if it was spilled.
+    */
+    bool acquire(size_t cell)
+    {
+        if (resident[cell])
+        {
+            recent.remove(cell);
+            recent.push_front(cell);
+            return true;
+        }
+        if (!loadCheckpoint(cells[cell], cellPath(cell), cellPhase, rank, nproc))
+        {
+            return false;
+        }
+        stats.loads += 1;
+        return admit(cell);
+    }
+
+    /*
+    Final eviction: free the triangulation of cell without writing it and remove its file,
+    once its output is written.
+    */
+    void evict(size_t cell)
+    {
+        if (resident[cell])
+        {
+            release(cell);
+        }
+        std::remove(cellPath(cell).c_str());
+    }
+};
+
+/*
+Out-of-core counterpart of runPhase over all cells of this rank, cell c with blockGroups[c]:
+every cell is loaded to start the phase, then again to finish it, so at most capacity
+triangulations are in memory at any time. The second pass walks the cells backwards,
+the last started cells are still resident.
+*/
+bool runPhase(CellStore &store, const std::vector<TaskGroup> &blockGroups, int phase, const std::vector<HaloTransport *> &transports)
+{
+    std::vector<std::optional<PhaseState>> states(store.size());
+    for (size_t cell = 0; cell < store.size(); ++cell)
+    {
+        if (!store.acquire(cell))
+        {
+            return false;
+        }
+        states[cell].emplace(startPhase(store.cell(cell), blockGroups[cell], phase, *transports[cell]));
+    }
+    for (size_t cell = store.size(); cell-- > 0;)
+    {
+        if (!store.acquire(cell))
+        {
+            return false;
+        }
+        finishPhase(store.cell(cell), *states[cell], *transports[cell]);
+        // the state lives in the cell's arena, drop it before the next reset
+        states[cell].reset();
+    }
+    return true;
+}
@@ -0,0 +1,318 @@
+#pragma once
+
+#include "main.hpp"
+#include "sfc.hpp"
+
+// OUTPUT
+
+/*
+Bounding box of all ranks' blocks, identical on every rank.
+*/
+Bbox2 globalBbox(mpi::communicator &world, const Bbox2 &bbox)
+{
+    Bbox2 global;
+    global.setMinX(mpi::all_reduce(world, bbox.get_minX(), mpi::minimum<double>()));
+    global.setMinY(mpi::all_reduce(world, bbox.get_minY(), mpi::minimum<double>()));
+    global.setMaxX(mpi::all_reduce(world, bbox.get_maxX(), mpi::maximum<double>()));
+    global.setMaxY(mpi::all_reduce(world, bbox.get_maxY(), mpi::maximum<double>()));
+    return global;
+}
+
+/*
+Write the final mesh with vertices and triangles ordered along a space filling curve.
+Every rank sorts the triangles its blocks own (barycenter in the block's half-open bbox, see ownsPoint) in parallel
+with the others, rank 0 merges the sorted runs into one mesh and writes it to path.
+A contiguous range of the output then covers a compact region of the domain.
+*/
+void saveCurveOrdered(mpi::communicator &world, std::vector<LocalMesh> &localMeshes, const std::string &path, Curve curve)
+{
+    Bbox2 bbox;
+    for (auto &localMesh : localMeshes)
+    {
+        bbox.add(localMesh.bbox);
+    }
+    SfcQuantizer quantizer(globalBbox(world, bbox), curve);
+    std::vector<SortedMesh> parts;
+    for (auto &localMesh : localMeshes)
+    {
+        parts.push_back(sortOwnedTriangles(localMesh.mesh, localMesh.bbox, quantizer, localMesh.heights,
+                                           [&](const Point2 &p) { return localMesh.isInsideDomain(p); }));
+    }
+
+    if (world.rank() == 0)
+    {
+        std::vector<std::vector<SortedMesh>> partsPerRank;
+        mpi::gather(world, parts, partsPerRank, 0);
+
+        std::vector<SortedMesh> allParts;
+        for (auto &rankParts : partsPerRank)
+        {
+            std::move(rankParts.begin(), rankParts.end(), std::back_inserter(allParts));
+        }
+        SortedMesh merged;
+        if (mergeSortedMeshes(allParts, merged))
+        {
+            writePly(merged.coordinates, merged.heights, merged.triangles, path);
+        }
+    }
+    else
+    {
+        mpi::gather(world, parts, 0);
+    }
+}
+
+/*
+Part files of a mesh written piece by piece, e.g. block by block while the out-of-core blocks
+are evicted for the last time, so the whole mesh is never in memory. Every rank appends its
+pieces to <path>.rank<r>.part; stitchMeshParts turns the parts into one PLY at path.
+A piece is a SortedMesh (see sortOwnedTriangles): uint64 vertex and triangle counts, uint8 1
+if it has heights, then the vertex keys, coordinates, heights (if any) and triangle indices.
+*/
+std::string meshPartPath(const std::string &path, int rank)
+{
+    return path + ".rank" + std::to_string(rank) + ".part";
+}
+
+bool appendMeshPart(std::ofstream &part, const SortedMesh &piece)
+{
+    writeBinary(part, uint64_t(piece.vertexKeys.size()));
+    writeBinary(part, uint64_t(piece.triangles.size() / 3));
+    writeBinary(part, uint8_t(!piece.heights.empty()));
+    part.write(reinterpret_cast<const char *>(piece.vertexKeys.data()), piece.vertexKeys.size() * sizeof(uint64_t));
+    part.write(reinterpret_cast<const char *>(piece.coordinates.data()), piece.coordinates.size() * sizeof(double));
+    part.write(reinterpret_cast<const char *>(piece.heights.data()), piece.heights.size() * sizeof(double));
+    part.write(reinterpret_cast<const char *>(piece.triangles.data()), piece.triangles.size() * sizeof(uint32_t));
+    part.flush();
+    return bool(part);
+}
+
+/*
+A piece of a part file while stitchMeshParts merges its vertices: where its arrays are in the
+file and a window of the next vertices, refilled with pread.
+*/
+struct MeshPartPiece
+{
+    static constexpr uint64_t window = 4096;
+
+    int fd = -1;
+    uint64_t numVertices = 0, numTriangles = 0;
+    uint64_t keyOffset = 0, coordinateOffset = 0, heightOffset = 0, triangleOffset = 0;
+    bool withHeights = false;
+
+    uint64_t next = 0, first = 0; // next vertex, first vertex in the window
+    std::vector<uint64_t> keys;
+    std::vector<double> coordinates, heights;
+    std::vector<uint32_t> remap; // merged index of the window's vertices, written back to the remap file
+
+    static bool readAt(int fd, void *data, uint64_t bytes, uint64_t offset)
+    {
+        return bytes == 0 || pread(fd, data, bytes, off_t(offset)) == ssize_t(bytes);
+    }
+
+    /*
+    Move the window to next.
+    */
+    bool fill()
+    {
+        first = next;
+        uint64_t count = std::min(window, numVertices - next);
+        keys.resize(count);
+        coordinates.resize(2 * count);
+        heights.resize(withHeights ? count : 0);
+        remap.clear();
+        return readAt(fd, keys.data(), count * sizeof(uint64_t), keyOffset + first * sizeof(uint64_t)) &&
+               readAt(fd, coordinates.data(), 2 * count * sizeof(double), coordinateOffset + 2 * first * sizeof(double)) &&
+               readAt(fd, heights.data(), heights.size() * sizeof(double), heightOffset + first * sizeof(double));
+    }
+
+    uint64_t key() const { return keys[next - first]; }
+    double x() const { return coordinates[2 * (next - first)]; }
+    double y() const { return coordinates[2 * (next - first) + 1]; }
+    double z() const { return withHeights ? heights[next - first] : 0.0; }
+
+    bool before(const MeshPartPiece &other) const
+    {
+        if (key() != other.key()) return key() < other.key();
+        if (x() != other.x()) return x() < other.x();
+        return y() < other.y();
+    }
+};
+
+/*
+Rank 0 stitches the part files of nproc ranks into one PLY at path and removes them.
+It k-way merges the pieces' sorted vertices as mergeSortedMeshes does (seam vertices of
+several pieces become one) into a temporary vertex file, noting the merged index of every
+piece vertex in a temporary remap file, then rewrites the triangles one piece at a time.
+Memory holds a window per piece and the remap of one piece, not the mesh.
+*/
+bool stitchMeshParts(const std::string &path, int nproc)
+{
+    std::vector<int> fds;
+    std::vector<MeshPartPiece> pieces;
+    bool ok = true;
+    for (int rank = 0; rank < nproc && ok; ++rank)
+    {
+        int fd = ::open(meshPartPath(path, rank).c_str(), O_RDONLY);
+        struct stat status;
+        if (fd < 0 || fstat(fd, &status) != 0)
+        {
+            std::cout << "Can't read " << meshPartPath(path, rank) << std::endl;
+            ok = false;
+            break;
+        }
+        fds.push_back(fd);
+        uint64_t size = uint64_t(status.st_size), offset = 0;
+        while (offset < size)
+        {
+            MeshPartPiece piece;
+            uint8_t withHeights = 0;
+            piece.fd = fd;
+            if (!MeshPartPiece::readAt(fd, &piece.numVertices, sizeof(uint64_t), offset) ||
+                !MeshPartPiece::readAt(fd, &piece.numTriangles, sizeof(uint64_t), offset + 8) ||
+                !MeshPartPiece::readAt(fd, &withHeights, 1, offset + 16))
+            {
+                ok = false;
+                break;
+            }
+            piece.withHeights = withHeights != 0;
+            piece.keyOffset = offset + 17;
+            piece.coordinateOffset = piece.keyOffset + piece.numVertices * sizeof(uint64_t);
+            piece.heightOffset = piece.coordinateOffset + 2 * piece.numVertices * sizeof(double);
+            piece.triangleOffset = piece.heightOffset + (piece.withHeights ? piece.numVertices * sizeof(double) : 0);
+            offset = piece.triangleOffset + 3 * piece.numTriangles * sizeof(uint32_t);
+            if (offset > size)
+            {
+                ok = false;
+                break;
+            }
+            pieces.push_back(std::move(piece));
+        }
+        if (!ok)
+        {
+            std::cout << "Truncated part file " << meshPartPath(path, rank) << std::endl;
+        }
+    }
+
+    // merged index of every piece vertex, piece by piece
+    std::vector<uint64_t> remapBase(pieces.size() + 1, 0);
+    for (size_t p = 0; p < pieces.size(); ++p)
+    {
+        remapBase[p + 1] = remapBase[p] + pieces[p].numVertices;
+    }
+    std::string vertexPath = path + ".vertices", facePath = path + ".faces", remapPath = path + ".remap";
+    std::ofstream vertices(vertexPath, std::ios::binary), faces(facePath, std::ios::binary);
+    int remapFd = ::open(remapPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ok = ok && vertices.is_open() && faces.is_open() && remapFd >= 0;
+    auto flushRemap = [&](size_t p)
+    {
+        MeshPartPiece &piece = pieces[p];
+        uint64_t bytes = piece.remap.size() * sizeof(uint32_t);
+        ok = ok && pwrite(remapFd, piece.remap.data(), bytes, off_t((remapBase[p] + piece.first) * sizeof(uint32_t))) == ssize_t(bytes);
+    };
+
+    // heap of pieces ordered by their next vertex
+    auto vertexLater = [&](size_t a, size_t b) { return pieces[b].before(pieces[a]); };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(vertexLater)> vertexHeap(vertexLater);
+    for (size_t p = 0; p < pieces.size() && ok; ++p)
+    {
+        ok = pieces[p].fill();
+        if (pieces[p].numVertices > 0) vertexHeap.push(p);
+    }
+    uint64_t numVertices = 0;
+    double lastX = 0, lastY = 0;
+    while (ok && !vertexHeap.empty())
+    {
+        size_t best = vertexHeap.top();
+        vertexHeap.pop();
+        MeshPartPiece &piece = pieces[best];
+        if (numVertices == 0 || piece.x() != lastX || piece.y() != lastY)
+        {
+            if (numVertices > uint64_t(UINT32_MAX))
+            {
+                std::cout << "Mesh too large for 32 bit indices, can't write " << path << std::endl;
+                ok = false;
+                break;
+            }
+            lastX = piece.x();
+            lastY = piece.y();
+            writeBinary(vertices, lastX);
+            writeBinary(vertices, lastY);
+            writeBinary(vertices, piece.z());
+            numVertices += 1;
+        }
+        piece.remap.push_back(uint32_t(numVertices - 1));
+
+        piece.next += 1;
+        if (piece.next - piece.first == piece.keys.size())
+        {
+            flushRemap(best);
+            ok = ok && piece.fill();
+        }
+        if (piece.next < piece.numVertices) vertexHeap.push(best);
+    }
+    for (auto &piece : pieces)
+    {
+        piece.keys = {};
+        piece.coordinates = {};
+        piece.heights = {};
+    }
+
+    // triangles piece by piece, with the piece's remap in memory
+    uint64_t numTriangles = 0;
+    std::vector<uint32_t> remap, triangles(3 * MeshPartPiece::window);
+    for (size_t p = 0; p < pieces.size() && ok; ++p)
+    {
+        MeshPartPiece &piece = pieces[p];
+        remap.resize(piece.numVertices);
+        ok = MeshPartPiece::readAt(remapFd, remap.data(), remap.size() * sizeof(uint32_t), remapBase[p] * sizeof(uint32_t));
+        for (uint64_t t = 0; t < piece.numTriangles && ok; t += MeshPartPiece::window)
+        {
+            uint64_t count = std::min(MeshPartPiece::window, piece.numTriangles - t);
+            ok = MeshPartPiece::readAt(piece.fd, triangles.data(), 3 * count * sizeof(uint32_t), piece.triangleOffset + 3 * t * sizeof(uint32_t));
+            for (uint64_t i = 0; i < 3 * count && ok; i += 3)
+            {
+                writeBinary(faces, uint8_t(3));
+                for (int corner = 0; corner < 3; ++corner)
+                {
+                    ok = ok && triangles[i + corner] < remap.size();
+                    writeBinary(faces, ok ? remap[triangles[i + corner]] : 0u);
+                }
+            }
+        }
+        numTriangles += piece.numTriangles;
+    }
+    vertices.close();
+    faces.close();
+    if (remapFd >= 0) ::close(remapFd);
+    for (int fd : fds) ::close(fd);
+
+    if (ok)
+    {
+        std::ofstream stream(path, std::ios::binary);
+        stream << "ply\nformat binary_little_endian 1.0\n"
+               << "element vertex " << numVertices << "\n"
+               << "property double x\nproperty double y\nproperty double z\n"
+               << "element face " << numTriangles << "\n"
+               << "property list uchar uint vertex_indices\nend_header\n";
+        for (std::string temporary : {vertexPath, facePath})
+        {
+            std::ifstream in(temporary, std::ios::binary);
+            stream << in.rdbuf();
+        }
+        stream.close();
+        ok = bool(stream);
+    }
+    if (!ok)
+    {
+        std::cout << "Can't write " << path << std::endl;
+    }
+    for (std::string temporary : {vertexPath, facePath, remapPath})
+    {
+        std::remove(temporary.c_str());
+    }
+    for (int rank = 0; rank < nproc; ++rank)
+    {
+        std::remove(meshPartPath(path, rank).c_str());
+    }
+    return ok;
+}
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <memory_resource>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "main.hpp"
+
+// QUALITY REPORT
+
+/*
+Per triangle measures of the owned domain triangles of one mesh, as SoA.
+sides holds the three squared side lengths of every triangle (not shared, so interior
+edges count once per adjacent triangle).
+*/
+struct TriangleMeasures
+{
+    std::pmr::vector<double> minAngle;    // degrees
+    std::pmr::vector<double> radiusEdge;  // circumradius / shortest side, 1/sqrt(3) for equilateral
+    std::pmr::vector<double> area;
+    std::pmr::vector<double> sides;
+
+    TriangleMeasures(std::pmr::memory_resource *resource) : minAngle(resource), radiusEdge(resource), area(resource), sides(resource) {}
+};
+
+/*
+Squared sides a, b, c -> cosine of the smallest angle and circumradius to shortest side
+ratio, for n triangles. The smallest angle lies between the two longer sides m <= l:
+cos = (m + l - s) / (2 sqrt(m l)), and R / sqrt(s) = sqrt(m l) / (4 area).
+The AVX2 path does 4 triangles per iteration, the scalar loop the rest.
+*/
+void triangleKernel(const double *a, const double *b, const double *c, const double *area, size_t n, double *cosine, double *radiusEdge)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256d vTwo = _mm256_set1_pd(2.0), vFour = _mm256_set1_pd(4.0);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d va = _mm256_loadu_pd(a + i), vb = _mm256_loadu_pd(b + i), vc = _mm256_loadu_pd(c + i);
+        __m256d shortest = _mm256_min_pd(va, _mm256_min_pd(vb, vc));
+        __m256d longest = _mm256_max_pd(va, _mm256_max_pd(vb, vc));
+        __m256d middle = _mm256_sub_pd(_mm256_add_pd(va, _mm256_add_pd(vb, vc)), _mm256_add_pd(shortest, longest));
+        __m256d root = _mm256_sqrt_pd(_mm256_mul_pd(middle, longest));
+        __m256d numerator = _mm256_sub_pd(_mm256_add_pd(middle, longest), shortest);
+        _mm256_storeu_pd(cosine + i, _mm256_div_pd(numerator, _mm256_mul_pd(vTwo, root)));
+        _mm256_storeu_pd(radiusEdge + i, _mm256_div_pd(root, _mm256_mul_pd(vFour, _mm256_loadu_pd(area + i))));
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        double shortest = std::min(a[i], std::min(b[i], c[i]));
+        double longest = std::max(a[i], std::max(b[i], c[i]));
+        double middle = a[i] + b[i] + c[i] - shortest - longest;
+        double root = std::sqrt(middle * longest);
+        cosine[i] = (middle + longest - shortest) / (2 * root);
+        radiusEdge[i] = root / (4 * area[i]);
+    }
+}
+
+/*
+Measure the triangles of localMesh it owns (barycenter in its half-open bbox, see ownsPoint) inside the domain.
+Temporaries come from the arena.
+*/
+TriangleMeasures measureTriangles(LocalMesh &localMesh)
+{
+    std::pmr::memory_resource *resource = localMesh.arena.resource();
+    TriangleMeasures measures(resource);
+    std::pmr::vector<double> a(resource), b(resource), c(resource);
+
+    localMesh.arena.triangles.clear();
+    localMesh.mesh.getTrianglePointers(localMesh.arena.triangles);
+    for (auto &triangle : localMesh.arena.triangles)
+    {
+        Point2 barycenter = triangle->getBarycenter();
+        if (!ownsPoint(localMesh.bbox, barycenter) || !localMesh.isInsideDomain(barycenter))
+        {
+            continue;
+        }
+        Point2 &p0 = *triangle->getCorner(0), &p1 = *triangle->getCorner(1), &p2 = *triangle->getCorner(2);
+        a.push_back(sqDistance2D(p1, p2));
+        b.push_back(sqDistance2D(p2, p0));
+        c.push_back(sqDistance2D(p0, p1));
+        measures.area.push_back(0.5 * std::fabs((p1.x() - p0.x()) * (p2.y() - p0.y()) - (p2.x() - p0.x()) * (p1.y() - p0.y())));
+    }
+
+    size_t n = a.size();
+    measures.minAngle.resize(n);
+    measures.radiusEdge.resize(n);
+    triangleKernel(a.data(), b.data(), c.data(), measures.area.data(), n, measures.minAngle.data(), measures.radiusEdge.data());
+    measures.sides.reserve(3 * n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        measures.minAngle[i] = std::acos(std::clamp(measures.minAngle[i], -1.0, 1.0)) * 180 / M_PI;
+        measures.sides.push_back(a[i]);
+        measures.sides.push_back(b[i]);
+        measures.sides.push_back(c[i]);
+    }
+    return measures;
+}
+
+/*
+Distributed quality summary. Angle and radius-edge histograms have fixed bins (1 degree
+up to 60, 0.1 up to 4 with the last bin open), area and side length histograms have
+logarithmic bins between the global extremes, so extremes are reduced before binning.
+All members are plain counters and extremes, merged across cells and ranks without the mesh.
+*/
+struct QualityReport
+{
+    static constexpr int angleBins = 60, ratioBins = 40, logBins = 50;
+
+    uint64_t triangles = 0;
+    double minAngle = 180, sumMinAngle = 0;
+    double maxRadiusEdge = 0;
+    double minArea = std::numeric_limits<double>::max(), maxArea = 0, totalArea = 0;
+    double minSide = std::numeric_limits<double>::max(), maxSide = 0;
+    std::array<uint64_t, angleBins> angleHistogram{};
+    std::array<uint64_t, ratioBins> ratioHistogram{};
+    std::array<uint64_t, logBins> areaHistogram{};
+    std::array<uint64_t, logBins> sideHistogram{};
+
+    /*
+    First pass: counts, sums and extremes of measures.
+    */
+    void addExtremes(const TriangleMeasures &measures)
+    {
+        triangles += measures.area.size();
+        for (size_t i = 0; i < measures.area.size(); ++i)
+        {
+            minAngle = std::min(minAngle, measures.minAngle[i]);
+            sumMinAngle += measures.minAngle[i];
+            maxRadiusEdge = std::max(maxRadiusEdge, measures.radiusEdge[i]);
+            minArea = std::min(minArea, measures.area[i]);
+            maxArea = std::max(maxArea, measures.area[i]);
+            totalArea += measures.area[i];
+        }
+        for (double side : measures.sides)
+        {
+            minSide = std::min(minSide, std::sqrt(side));
+            maxSide = std::max(maxSide, std::sqrt(side));
+        }
+    }
+
+    /*
+    Combine the counts, sums and extremes of all ranks on every rank (before binning).
+    */
+    void reduceExtremes(mpi::communicator &world)
+    {
+        MPI_Comm comm = MPI_Comm(world);
+        MPI_Allreduce(MPI_IN_PLACE, &triangles, 1, MPI_UINT64_T, MPI_SUM, comm);
+        double sums[2] = {sumMinAngle, totalArea};
+        MPI_Allreduce(MPI_IN_PLACE, sums, 2, MPI_DOUBLE, MPI_SUM, comm);
+        double minima[3] = {minAngle, minArea, minSide};
+        MPI_Allreduce(MPI_IN_PLACE, minima, 3, MPI_DOUBLE, MPI_MIN, comm);
+        double maxima[3] = {maxRadiusEdge, maxArea, maxSide};
+        MPI_Allreduce(MPI_IN_PLACE, maxima, 3, MPI_DOUBLE, MPI_MAX, comm);
+        sumMinAngle = sums[0];
+        totalArea = sums[1];
+        minAngle = minima[0];
+        minArea = minima[1];
+        minSide = minima[2];
+        maxRadiusEdge = maxima[0];
+        maxArea = maxima[1];
+        maxSide = maxima[2];
+    }
+
+    static int logBin(double value, double low, double high)
+    {
+        if (!(high > low) || value <= low)
+        {
+            return 0;
+        }
+        double position = std::log(value / low) / std::log(high / low);
+        return std::min(logBins - 1, int(position * logBins));
+    }
+
+    /*
+    Second pass, once the extremes are global: histograms of measures.
+    */
+    void addHistograms(const TriangleMeasures &measures)
+    {
+        for (size_t i = 0; i < measures.area.size(); ++i)
+        {
+            angleHistogram[std::clamp(int(measures.minAngle[i]), 0, angleBins - 1)] += 1;
+            ratioHistogram[std::clamp(int(measures.radiusEdge[i] * 10), 0, ratioBins - 1)] += 1;
+            areaHistogram[logBin(measures.area[i], minArea, maxArea)] += 1;
+        }
+        for (double side : measures.sides)
+        {
+            sideHistogram[logBin(std::sqrt(side), minSide, maxSide)] += 1;
+        }
+    }
+
+    /*
+    Sum the histograms of all ranks on rank 0.
+    */
+    void reduceHistograms(mpi::communicator &world)
+    {
+        for (auto *histogram : {angleHistogram.data(), ratioHistogram.data(), areaHistogram.data(), sideHistogram.data()})
+        {
+            int bins = histogram == angleHistogram.data() ? angleBins : histogram == ratioHistogram.data() ? ratioBins : logBins;
+            MPI_Reduce(world.rank() == 0 ? MPI_IN_PLACE : histogram, histogram, bins, MPI_UINT64_T, MPI_SUM, 0, MPI_Comm(world));
+        }
+    }
+
+    /*
+    Write the summary as JSON: totals, extremes and histograms with the lower edge of every bin.
+    */
+    bool writeJson(const std::string &path) const
+    {
+        std::ofstream stream(path);
+        if (!stream.is_open())
+        {
+            std::cout << "Can't write " << path << std::endl;
+            return false;
+        }
+        auto histogram = [&](const char *name, const uint64_t *counts, int bins, const std::function<double(int)> &lowerEdge, bool last)
+        {
+            stream << "  \"" << name << "\": {\"lower\": [";
+            for (int bin = 0; bin < bins; ++bin)
+            {
+                stream << (bin ? ", " : "") << lowerEdge(bin);
+            }
+            stream << "], \"count\": [";
+            for (int bin = 0; bin < bins; ++bin)
+            {
+                stream << (bin ? ", " : "") << counts[bin];
+            }
+            stream << "]}" << (last ? "\n" : ",\n");
+        };
+        auto logEdge = [](double low, double high)
+        { return [=](int bin) { return low * std::pow(high / low, double(bin) / logBins); }; };
+
+        stream << std::setprecision(10) << "{\n"
+               << "  \"triangles\": " << triangles << ",\n"
+               << "  \"area\": {\"total\": " << totalArea << ", \"min\": " << minArea << ", \"max\": " << maxArea << "},\n"
+               << "  \"minAngle\": {\"min\": " << minAngle << ", \"mean\": " << (triangles ? sumMinAngle / triangles : 0) << "},\n"
+               << "  \"radiusEdge\": {\"max\": " << maxRadiusEdge << "},\n"
+               << "  \"side\": {\"min\": " << minSide << ", \"max\": " << maxSide << "},\n";
+        histogram("minAngleHistogram", angleHistogram.data(), angleBins, [](int bin) { return double(bin); }, false);
+        histogram("radiusEdgeHistogram", ratioHistogram.data(), ratioBins, [](int bin) { return bin / 10.0; }, false);
+        histogram("areaHistogram", areaHistogram.data(), logBins, logEdge(minArea, maxArea), false);
+        histogram("sideHistogram", sideHistogram.data(), logBins, logEdge(minSide, maxSide), true);
+        stream << "}\n";
+        return bool(stream);
+    }
+};
+
+/*
+Collective quality report over the numBlocks blocks of every rank, written as JSON to path
+by rank 0. block(b) makes block b available (e.g. CellStore::acquire). Every block is
+measured once, into its arena, and binned after the extremes are known.
+*/
+void writeQualityReport(mpi::communicator &world, size_t numBlocks, const std::function<LocalMesh &(size_t)> &block, const std::string &path)
+{
+    QualityReport report;
+    std::vector<TriangleMeasures> measures;
+    for (size_t b = 0; b < numBlocks; ++b)
+    {
+        LocalMesh &localMesh = block(b);
+        localMesh.arena.reset();
+        measures.push_back(measureTriangles(localMesh));
+        report.addExtremes(measures.back());
+    }
+    report.reduceExtremes(world);
+    for (auto &blockMeasures : measures)
+    {
+        report.addHistograms(blockMeasures);
+    }
+    report.reduceHistograms(world);
+    measures.clear();
+    if (world.rank() == 0)
+    {
+        report.writeJson(path);
+    }
+}
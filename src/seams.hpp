@@ -0,0 +1,294 @@
+#pragma once
+
+#include <bit>
+#include <unordered_set>
+
+#include "halo.hpp"
+
+// SEAM VALIDATION
+
+/*
+Seam messages use their own phase numbers, far from the schedule's (and not congruent to
+a nearby phase modulo 64, see BlockHaloTransport), so they never match a halo.
+*/
+inline int seamPhase(int phase)
+{
+    return 1000 + phase;
+}
+
+/*
+Disagreements between the blocks along their seams, summed over blocks (and ranks).
+An edge is a seam edge if its two triangles have their barycenters in different blocks,
+each point counted in exactly one block (half-open boxes on the shared grid lines).
+*/
+struct SeamStats
+{
+    size_t edges = 0;      // seam edges of the blocks' own triangles
+    size_t mismatched = 0; // seam edges a neighbor has that this block doesn't (a gap, or different triangles)
+    size_t duplicated = 0; // seam triangles of a neighbor this block owns as well (boxes that overlap)
+    size_t violations = 0; // neighbor vertices missing here and inside the circumcircle of an own seam triangle
+
+    size_t defects() const
+    {
+        return mismatched + duplicated + violations;
+    }
+};
+
+/*
+Side of box that p is on, -1/0/1 per axis (0 inside). Boxes are half-open: a point on the
+max edge shared with a neighbor belongs to the neighbor, so both see the same side.
+*/
+inline std::pair<int, int> seamSide(const Point2 &p, const Bbox2 &box)
+{
+    int dx = p.x() < box.get_minX() ? -1 : p.x() >= box.get_maxX() ? 1 : 0;
+    int dy = p.y() < box.get_minY() ? -1 : p.y() >= box.get_maxY() ? 1 : 0;
+    return {dx, dy};
+}
+
+/*
+The neighbor direction of a side (rows grow downwards, as in splitMesh), nullopt for the inside.
+*/
+inline std::optional<Neighbor> sideNeighbor(std::pair<int, int> side)
+{
+    static const Neighbor directions[3][3] = {{Neighbor::TL, Neighbor::Top, Neighbor::TR},
+                                              {Neighbor::Left, Neighbor::Left /* inside, not used */, Neighbor::Right},
+                                              {Neighbor::BL, Neighbor::Bottom, Neighbor::BR}};
+    if (side.first == 0 && side.second == 0)
+    {
+        return std::nullopt;
+    }
+    return directions[side.second + 1][side.first + 1];
+}
+
+inline uint64_t hashPoint(const Point2 &p)
+{
+    // +0.0 folds -0.0 into 0.0, mixed as in splitmix64
+    uint64_t h = std::bit_cast<uint64_t>(p.x() + 0.0) * 0x9e3779b97f4a7c15ull ^ std::bit_cast<uint64_t>(p.y() + 0.0);
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+/*
+Order independent hashes of an edge and of a triangle by their corners.
+*/
+inline uint64_t hashEdge(const Point2 &a, const Point2 &b)
+{
+    uint64_t ha = hashPoint(a), hb = hashPoint(b);
+    return hashPoint(Point2(double(std::min(ha, hb) >> 11), double(std::max(ha, hb) >> 11)));
+}
+
+inline uint64_t hashTriangle(const Point2 &a, const Point2 &b, const Point2 &c)
+{
+    return hashPoint(a) + hashPoint(b) + hashPoint(c);
+}
+
+/*
+True if d is strictly inside the circumcircle of the counterclockwise triangle a, b, c,
+beyond a relative tolerance (a point on the circle is not a violation).
+*/
+bool inCircumcircle(const Point2 &a, const Point2 &b, const Point2 &c, const Point2 &d)
+{
+    double adx = a.x() - d.x(), ady = a.y() - d.y();
+    double bdx = b.x() - d.x(), bdy = b.y() - d.y();
+    double cdx = c.x() - d.x(), cdy = c.y() - d.y();
+    double alift = adx * adx + ady * ady, blift = bdx * bdx + bdy * bdy, clift = cdx * cdx + cdy * cdy;
+    double det = alift * (bdx * cdy - cdx * bdy) + blift * (cdx * ady - adx * cdy) + clift * (adx * bdy - bdx * ady);
+    double permanent = alift * (std::fabs(bdx * cdy) + std::fabs(cdx * bdy)) + blift * (std::fabs(cdx * ady) + std::fabs(adx * cdy)) +
+                       clift * (std::fabs(adx * bdy) + std::fabs(bdx * ady));
+    return det > 1e-12 * permanent;
+}
+
+/*
+What one block knows about its seam with one neighbor: the hashes of its seam edges and
+of its triangles along the seam (sent).
+*/
+struct SeamSide
+{
+    std::pmr::unordered_set<uint64_t> edges;
+    std::pmr::unordered_set<uint64_t> triangles;
+
+    SeamSide(std::pmr::memory_resource *resource) : edges(resource), triangles(resource) {}
+};
+
+/*
+The seams of one block with all its neighbors, and the hashes of all the triangles it owns.
+*/
+struct BlockSeams
+{
+    std::pmr::unordered_map<Neighbor, SeamSide> sides;
+    std::pmr::unordered_set<uint64_t> owned;
+
+    BlockSeams(std::pmr::memory_resource *resource) : sides(resource), owned(resource) {}
+};
+
+/*
+Seams of localMesh with all its neighbors, and the message to each of them: the corners
+of its seam triangles (3 points each) and its seam edges. Only the triangles the block
+owns (half-open bbox, see ownsPoint, as the output selects) take part.
+*/
+void collectSeams(LocalMesh &localMesh, BlockSeams &seams, std::pmr::unordered_map<Neighbor, HaloPayload> &payloads)
+{
+    std::pmr::memory_resource *resource = localMesh.arena.resource();
+    auto &sides = seams.sides;
+    for (Neighbor neighbor : allNeighbors)
+    {
+        if (localMesh.neighbors[neighbor].has_value())
+        {
+            sides.emplace(neighbor, SeamSide(resource));
+            payloads.emplace(neighbor, HaloPayload(resource));
+        }
+    }
+    auto addTriangle = [&](Neighbor neighbor, Triangle2 *triangle)
+    {
+        Point2 &p0 = *triangle->getCorner(0), &p1 = *triangle->getCorner(1), &p2 = *triangle->getCorner(2);
+        if (sides.at(neighbor).triangles.insert(hashTriangle(p0, p1, p2)).second)
+        {
+            payloads.at(neighbor).points.insert(payloads.at(neighbor).points.end(), {p0, p1, p2});
+        }
+    };
+
+    const Bbox2 &bbox = localMesh.bbox;
+    localMesh.arena.triangles.clear();
+    localMesh.mesh.getTrianglePointers(localMesh.arena.triangles);
+    for (auto &triangle : localMesh.arena.triangles)
+    {
+        if (!ownsPoint(bbox, triangle->getBarycenter()))
+        {
+            continue;
+        }
+        seams.owned.insert(hashTriangle(*triangle->getCorner(0), *triangle->getCorner(1), *triangle->getCorner(2)));
+        for (int i = 0; i < 3; ++i)
+        {
+            Triangle2 *across = triangle->getOppositeTriangle(i);
+            if (across == nullptr)
+            {
+                continue;
+            }
+            std::optional<Neighbor> neighbor = sideNeighbor(seamSide(across->getBarycenter(), bbox));
+            if (!neighbor.has_value() || !sides.count(neighbor.value()))
+            {
+                continue;
+            }
+            Point2 &a = *triangle->getCorner((i + 1) % 3), &b = *triangle->getCorner((i + 2) % 3);
+            if (sides.at(neighbor.value()).edges.insert(hashEdge(a, b)).second)
+            {
+                payloads.at(neighbor.value()).segments.push_back(Segment2(a, b));
+            }
+            addTriangle(neighbor.value(), triangle);
+        }
+    }
+}
+
+/*
+Compare the seam message of a neighbor with this block's side of that seam (and its owned triangles).
+The empty circle test only looks at the neighbor's vertices this mesh does not have (its own
+vertices are Fade's business, see checkValidity), against the triangle containing the vertex
+here and the triangles across its edges, if they are this block's.
+*/
+void checkSeam(LocalMesh &localMesh, const BlockSeams &seams, Neighbor source, const HaloPayload &payload, SeamStats &stats)
+{
+    const SeamSide &side = seams.sides.at(source);
+    for (auto &edge : payload.segments)
+    {
+        if (!side.edges.count(hashEdge(edge.getSrc(), edge.getTrg())))
+        {
+            stats.mismatched += 1;
+        }
+    }
+
+    // the neighbor owns its seam triangles, so none of them may be owned here
+    for (size_t i = 0; i + 2 < payload.points.size(); i += 3)
+    {
+        if (seams.owned.count(hashTriangle(payload.points[i], payload.points[i + 1], payload.points[i + 2])))
+        {
+            stats.duplicated += 1;
+        }
+    }
+
+    auto owned = [&](Triangle2 *triangle)
+    { return triangle != nullptr && ownsPoint(localMesh.bbox, triangle->getBarycenter()); };
+    std::pmr::unordered_set<uint64_t> tested(localMesh.arena.resource());
+    for (auto &point : payload.points)
+    {
+        if (!tested.insert(hashPoint(point)).second)
+        {
+            continue;
+        }
+        Triangle2 *container = localMesh.mesh.locate(point);
+        if (container == nullptr)
+        {
+            continue; // outside this mesh, nothing of this block is near
+        }
+        bool isVertex = false;
+        for (int c = 0; c < 3; ++c)
+        {
+            isVertex = isVertex || (container->getCorner(c)->x() == point.x() && container->getCorner(c)->y() == point.y());
+        }
+        if (isVertex)
+        {
+            continue;
+        }
+        bool violated = false;
+        for (Triangle2 *candidate : {container, container->getOppositeTriangle(0), container->getOppositeTriangle(1), container->getOppositeTriangle(2)})
+        {
+            violated = violated || (owned(candidate) &&
+                                    inCircumcircle(*candidate->getCorner(0), *candidate->getCorner(1), *candidate->getCorner(2), point));
+        }
+        stats.violations += violated ? 1 : 0;
+    }
+}
+
+/*
+Collective seam check over the numBlocks blocks of every rank (block(b) makes block b
+available, e.g. CellStore::acquire), exchanging the seam messages through the halo
+transports as phase seamPhase(phase). Every block sends to all its neighbors before
+any block checks, as in runPhase. Rank 0 prints the totals with label, all ranks get
+them back. Blocks' arenas are reset.
+*/
+SeamStats validateSeams(mpi::communicator &world, size_t numBlocks, const std::function<LocalMesh &(size_t)> &block, int phase,
+                        const std::vector<HaloTransport *> &transports, const std::string &label)
+{
+    SeamStats stats;
+    std::vector<std::optional<BlockSeams>> seams(numBlocks);
+    for (size_t b = 0; b < numBlocks; ++b)
+    {
+        LocalMesh &localMesh = block(b);
+        localMesh.arena.reset();
+        std::pmr::memory_resource *resource = localMesh.arena.resource();
+        seams[b].emplace(resource);
+        std::pmr::unordered_map<Neighbor, HaloPayload> payloads(resource);
+        collectSeams(localMesh, *seams[b], payloads);
+
+        std::vector<Neighbor> sources;
+        for (auto &[neighbor, side] : seams[b]->sides)
+        {
+            sources.push_back(neighbor);
+            stats.edges += side.edges.size();
+        }
+        transports[b]->postReceives(seamPhase(phase), sources);
+        for (auto &[neighbor, payload] : payloads)
+        {
+            transports[b]->send(seamPhase(phase), neighbor, std::move(payload));
+        }
+    }
+    for (size_t b = numBlocks; b-- > 0;)
+    {
+        LocalMesh &localMesh = block(b);
+        transports[b]->complete([&](Neighbor source, HaloPayload &payload)
+                                { checkSeam(localMesh, *seams[b], source, payload, stats); });
+        // the seams live in the block's arena, drop them before the next reset
+        seams[b].reset();
+    }
+
+    // every seam edge is counted from both sides, every duplicate too
+    unsigned long long totals[4] = {stats.edges, stats.mismatched, stats.duplicated, stats.violations};
+    MPI_Allreduce(MPI_IN_PLACE, totals, 4, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_Comm(world));
+    SeamStats global{totals[0] / 2, totals[1], totals[2] / 2, totals[3]};
+    if (world.rank() == 0)
+    {
+        std::cout << "Seams [" << label << "] " << global.edges << " edges, " << global.mismatched << " mismatched, "
+                  << global.duplicated << " duplicated triangles, " << global.violations << " empty circle violations" << std::endl;
+    }
+    return global;
+}
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+#include <Fade_2D.h>
+#include <boost/serialization/vector.hpp>
+
+#include "heights.hpp"
+#include "constraint.hpp"
+
+using namespace GEOM_FADE2D;
+
+// SPACE FILLING CURVES
+
+enum class Curve
+{
+    Morton,
+    Hilbert
+};
+
+/*
+Spread the 32 bits of v to the even bits of a 64 bit word.
+*/
+inline uint64_t spreadBits(uint32_t v)
+{
+    uint64_t x = v;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    x = (x | (x << 1)) & 0x5555555555555555ull;
+    return x;
+}
+
+inline uint64_t mortonKey(uint32_t x, uint32_t y)
+{
+    return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+/*
+Distance of (x, y) along the Hilbert curve filling the 2^32 x 2^32 grid.
+*/
+inline uint64_t hilbertKey(uint32_t x, uint32_t y)
+{
+    uint64_t key = 0;
+    for (uint32_t s = 1u << 31; s > 0; s >>= 1)
+    {
+        uint32_t rx = (x & s) ? 1 : 0;
+        uint32_t ry = (y & s) ? 1 : 0;
+        key += uint64_t(s) * uint64_t(s) * ((3 * rx) ^ ry);
+
+        // rotate the quadrant so the sub-curve has the canonical orientation
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = ~x;
+                y = ~y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return key;
+}
+
+/*
+Maps coordinates inside a domain box to 32 bit grid coordinates and curve keys.
+All ranks must use the same domain (the global bbox) so their keys are comparable.
+*/
+struct SfcQuantizer
+{
+    double minX = 0, minY = 0;
+    double scale = 1;
+    Curve curve = Curve::Hilbert;
+
+    SfcQuantizer() {}
+
+    SfcQuantizer(const Bbox2 &domain, Curve curve)
+    {
+        minX = domain.get_minX();
+        minY = domain.get_minY();
+        double range = std::max(domain.getMaxRange(), 1e-300);
+        scale = 4294967295.0 / range;
+        this->curve = curve;
+    }
+
+    uint32_t quantize(double value, double min) const
+    {
+        double q = (value - min) * scale;
+        return q <= 0 ? 0u : (q >= 4294967295.0 ? 4294967295u : uint32_t(q));
+    }
+
+    uint64_t key(double x, double y) const
+    {
+        uint32_t qx = quantize(x, minX);
+        uint32_t qy = quantize(y, minY);
+        return curve == Curve::Hilbert ? hilbertKey(qx, qy) : mortonKey(qx, qy);
+    }
+};
+
+/*
+The triangles owned by one rank, with vertices and triangles sorted along the curve.
+Triangles index the sorted vertex list of the same SortedMesh. mergeSortedMeshes
+produces one as well, for the whole mesh.
+*/
+struct SortedMesh
+{
+    std::vector<uint64_t> vertexKeys;
+    std::vector<double> coordinates; // x0, y0, x1, y1, ...
+    std::vector<double> heights;     // z0, z1, ... of a terrain mesh, else empty
+    std::vector<uint64_t> triangleKeys;
+    std::vector<uint32_t> triangles;
+
+    template <class Archive>
+    void serialize(Archive &archive, const unsigned /* version */)
+    {
+        archive & vertexKeys;
+        archive & coordinates;
+        archive & heights;
+        archive & triangleKeys;
+        archive & triangles;
+    }
+};
+
+/*
+Vertex order (key, x, y): equal coordinates are adjacent, so seam duplicates from
+different ranks meet during the merge.
+*/
+inline bool vertexBefore(const SortedMesh &a, size_t i, const SortedMesh &b, size_t j)
+{
+    if (a.vertexKeys[i] != b.vertexKeys[j]) return a.vertexKeys[i] < b.vertexKeys[j];
+    if (a.coordinates[2 * i] != b.coordinates[2 * j]) return a.coordinates[2 * i] < b.coordinates[2 * j];
+    return a.coordinates[2 * i + 1] < b.coordinates[2 * j + 1];
+}
+
+/*
+Sort the triangles of mesh whose barycenter lies in owned (half-open, see ownsPoint; all if
+owned is invalid) and inside the domain (inDomain, e.g. LocalMesh::isInsideDomain; all if empty),
+and their vertices along the curve. A triangle's key is the key of its barycenter.
+The vertices carry their heights if heights is a terrain's (not empty).
+*/
+SortedMesh sortOwnedTriangles(Fade_2D &mesh, const Bbox2 &owned, const SfcQuantizer &quantizer, const HeightTable &heights = HeightTable(),
+                              const std::function<bool(const Point2 &)> &inDomain = nullptr)
+{
+    std::vector<Triangle2 *> allTriangles, triangles;
+    mesh.getTrianglePointers(allTriangles);
+    for (auto &triangle : allTriangles)
+    {
+        Point2 barycenter = triangle->getBarycenter();
+        if ((!owned.isValid() || ownsPoint(owned, barycenter)) && (!inDomain || inDomain(barycenter)))
+        {
+            triangles.push_back(triangle);
+        }
+    }
+
+    // unsorted vertices of the owned triangles
+    std::unordered_map<Point2 *, uint32_t> pointIndex;
+    std::vector<Point2 *> vertices;
+    for (auto &triangle : triangles)
+    {
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            if (pointIndex.emplace(triangle->getCorner(corner), uint32_t(vertices.size())).second)
+            {
+                vertices.push_back(triangle->getCorner(corner));
+            }
+        }
+    }
+
+    SortedMesh unsorted;
+    for (auto &vertex : vertices)
+    {
+        unsorted.vertexKeys.push_back(quantizer.key(vertex->x(), vertex->y()));
+        unsorted.coordinates.insert(unsorted.coordinates.end(), {vertex->x(), vertex->y()});
+        if (!heights.empty())
+        {
+            unsorted.heights.push_back(heights.has(*vertex) ? heights.at(*vertex) : 0.0);
+        }
+    }
+
+    std::vector<uint32_t> vertexOrder(vertices.size());
+    for (size_t i = 0; i < vertexOrder.size(); ++i) vertexOrder[i] = uint32_t(i);
+    std::sort(vertexOrder.begin(), vertexOrder.end(), [&](uint32_t a, uint32_t b)
+              { return vertexBefore(unsorted, a, unsorted, b); });
+
+    SortedMesh sorted;
+    std::vector<uint32_t> newIndex(vertices.size());
+    for (size_t i = 0; i < vertexOrder.size(); ++i)
+    {
+        uint32_t old = vertexOrder[i];
+        newIndex[old] = uint32_t(i);
+        sorted.vertexKeys.push_back(unsorted.vertexKeys[old]);
+        sorted.coordinates.insert(sorted.coordinates.end(), {unsorted.coordinates[2 * old], unsorted.coordinates[2 * old + 1]});
+        if (!unsorted.heights.empty())
+        {
+            sorted.heights.push_back(unsorted.heights[old]);
+        }
+    }
+
+    std::vector<uint64_t> triangleKeys;
+    for (auto &triangle : triangles)
+    {
+        Point2 center = triangle->getBarycenter();
+        triangleKeys.push_back(quantizer.key(center.x(), center.y()));
+    }
+    std::vector<uint32_t> triangleOrder(triangles.size());
+    for (size_t i = 0; i < triangleOrder.size(); ++i) triangleOrder[i] = uint32_t(i);
+    std::sort(triangleOrder.begin(), triangleOrder.end(), [&](uint32_t a, uint32_t b)
+              { return triangleKeys[a] < triangleKeys[b]; });
+
+    for (uint32_t t : triangleOrder)
+    {
+        sorted.triangleKeys.push_back(triangleKeys[t]);
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            sorted.triangles.push_back(newIndex[pointIndex[triangles[t]->getCorner(corner)]]);
+        }
+    }
+    return sorted;
+}
+
+/*
+k-way merge of the per-rank sorted meshes into merged (the previous content is replaced).
+Seam vertices present on several ranks are merged into one, triangle indices are rewritten
+to the merged vertex order. merged carries heights if any part does. Returns false if the
+merged mesh has too many vertices for 32 bit indices.
+*/
+bool mergeSortedMeshes(const std::vector<SortedMesh> &parts, SortedMesh &merged)
+{
+    // merge vertices, remembering where every per-part vertex went
+    std::vector<std::vector<uint32_t>> globalIndex(parts.size());
+    std::vector<size_t> next(parts.size(), 0);
+    merged = SortedMesh();
+    std::vector<double> &coordinates = merged.coordinates, &heights = merged.heights;
+    bool withHeights = false;
+    for (size_t p = 0; p < parts.size(); ++p)
+    {
+        globalIndex[p].resize(parts[p].vertexKeys.size());
+        withHeights = withHeights || !parts[p].heights.empty();
+    }
+
+    // heap of parts ordered by their next vertex, O(n log k) for k parts
+    auto vertexLater = [&](size_t a, size_t b)
+    { return vertexBefore(parts[b], next[b], parts[a], next[a]); };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(vertexLater)> vertexHeap(vertexLater);
+    for (size_t p = 0; p < parts.size(); ++p)
+    {
+        if (!parts[p].vertexKeys.empty()) vertexHeap.push(p);
+    }
+    while (!vertexHeap.empty())
+    {
+        size_t best = vertexHeap.top();
+        vertexHeap.pop();
+
+        const SortedMesh &part = parts[best];
+        size_t i = next[best]++;
+        size_t count = coordinates.size() / 2;
+        bool duplicate = count > 0 && coordinates[2 * count - 2] == part.coordinates[2 * i] && coordinates[2 * count - 1] == part.coordinates[2 * i + 1];
+        if (!duplicate)
+        {
+            if (count > uint64_t(UINT32_MAX))
+            {
+                std::cout << "Mesh too large for 32 bit indices" << std::endl;
+                return false;
+            }
+            merged.vertexKeys.push_back(part.vertexKeys[i]);
+            coordinates.insert(coordinates.end(), {part.coordinates[2 * i], part.coordinates[2 * i + 1]});
+            if (withHeights)
+            {
+                heights.push_back(part.heights.empty() ? 0.0 : part.heights[i]);
+            }
+        }
+        globalIndex[best][i] = uint32_t(coordinates.size() / 2 - 1);
+
+        if (next[best] < part.vertexKeys.size()) vertexHeap.push(best);
+    }
+
+    // merge triangles by key and rewrite their indices
+    std::vector<uint32_t> &triangles = merged.triangles;
+    std::fill(next.begin(), next.end(), 0);
+    auto triangleLater = [&](size_t a, size_t b)
+    { return parts[b].triangleKeys[next[b]] < parts[a].triangleKeys[next[a]]; };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(triangleLater)> triangleHeap(triangleLater);
+    for (size_t p = 0; p < parts.size(); ++p)
+    {
+        if (!parts[p].triangleKeys.empty()) triangleHeap.push(p);
+    }
+    while (!triangleHeap.empty())
+    {
+        size_t best = triangleHeap.top();
+        triangleHeap.pop();
+        size_t t = next[best]++;
+        merged.triangleKeys.push_back(parts[best].triangleKeys[t]);
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            triangles.push_back(globalIndex[best][parts[best].triangles[3 * t + corner]]);
+        }
+        if (next[best] < parts[best].triangleKeys.size()) triangleHeap.push(best);
+    }
+
+    return true;
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <memory_resource>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <Fade_2D.h>
+
+using namespace GEOM_FADE2D;
+
+// VERTEX SNAPSHOT
+
+/*
+Structure-of-arrays copy of the vertices of a mesh: x[i], y[i] are the coordinates
+of handles[i]. Range queries stream over two dense double arrays instead of
+dereferencing scattered Point2 objects, and are vectorized (AVX-512, AVX2 or scalar,
+chosen at compile time). Kept up to date with add and remove after every change of the
+mesh; if the vertex count ever disagrees with the mesh it is rebuilt from scratch.
+*/
+class VertexSnapshot
+{
+public:
+    std::vector<double> x, y;
+    std::vector<Point2 *> handles;
+
+private:
+    std::unordered_map<Point2 *, uint32_t> index;
+    bool valid = false;
+
+    /*
+    Bitmask of which of the count (<= 8) vertices from first on lie in box (bounds inclusive, as Bbox2::isInBox).
+    */
+    uint32_t inBox(size_t first, size_t count, const Bbox2 &box) const
+    {
+        double minX = box.get_minX(), minY = box.get_minY(), maxX = box.get_maxX(), maxY = box.get_maxY();
+        size_t i = 0;
+        uint32_t mask = 0;
+#if defined(__AVX512F__)
+        if (count == 8)
+        {
+            __m512d vx = _mm512_loadu_pd(x.data() + first), vy = _mm512_loadu_pd(y.data() + first);
+            __mmask8 m = _mm512_cmp_pd_mask(vx, _mm512_set1_pd(minX), _CMP_GE_OQ);
+            m &= _mm512_cmp_pd_mask(vx, _mm512_set1_pd(maxX), _CMP_LE_OQ);
+            m &= _mm512_cmp_pd_mask(vy, _mm512_set1_pd(minY), _CMP_GE_OQ);
+            m &= _mm512_cmp_pd_mask(vy, _mm512_set1_pd(maxY), _CMP_LE_OQ);
+            return uint32_t(m);
+        }
+#elif defined(__AVX2__)
+        for (; i + 4 <= count; i += 4)
+        {
+            __m256d vx = _mm256_loadu_pd(x.data() + first + i), vy = _mm256_loadu_pd(y.data() + first + i);
+            __m256d m = _mm256_and_pd(_mm256_cmp_pd(vx, _mm256_set1_pd(minX), _CMP_GE_OQ),
+                                      _mm256_cmp_pd(vx, _mm256_set1_pd(maxX), _CMP_LE_OQ));
+            m = _mm256_and_pd(m, _mm256_cmp_pd(vy, _mm256_set1_pd(minY), _CMP_GE_OQ));
+            m = _mm256_and_pd(m, _mm256_cmp_pd(vy, _mm256_set1_pd(maxY), _CMP_LE_OQ));
+            mask |= uint32_t(_mm256_movemask_pd(m)) << i;
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            double px = x[first + i], py = y[first + i];
+            if (px >= minX && px <= maxX && py >= minY && py <= maxY)
+            {
+                mask |= 1u << i;
+            }
+        }
+        return mask;
+    }
+
+public:
+    VertexSnapshot() {}
+
+    // handles belong to one mesh, a copy (of a copied LocalMesh) is rebuilt on first use
+    VertexSnapshot(const VertexSnapshot &) {}
+
+    VertexSnapshot &operator=(const VertexSnapshot &)
+    {
+        invalidate();
+        return *this;
+    }
+
+    size_t size() const
+    {
+        return handles.size();
+    }
+
+    void invalidate()
+    {
+        valid = false;
+    }
+
+    /*
+    Give the memory back (the mesh is leaving memory), the next sync rebuilds.
+    */
+    void release()
+    {
+        std::vector<double>().swap(x);
+        std::vector<double>().swap(y);
+        std::vector<Point2 *>().swap(handles);
+        std::unordered_map<Point2 *, uint32_t>().swap(index);
+        valid = false;
+    }
+
+    void rebuild(Fade_2D &mesh)
+    {
+        x.clear();
+        y.clear();
+        handles.clear();
+        index.clear();
+        mesh.getVertexPointers(handles);
+        x.reserve(handles.size());
+        y.reserve(handles.size());
+        for (size_t i = 0; i < handles.size(); ++i)
+        {
+            x.push_back(handles[i]->x());
+            y.push_back(handles[i]->y());
+            index[handles[i]] = uint32_t(i);
+        }
+        valid = true;
+    }
+
+    /*
+    Rebuild if never built, invalidated, or out of step with the mesh.
+    */
+    void sync(Fade_2D &mesh)
+    {
+        if (!valid || handles.size() != mesh.numberOfPoints())
+        {
+            rebuild(mesh);
+        }
+    }
+
+    /*
+    Add a vertex (no-op if it is already present, e.g. an inserted point that coincided with a vertex).
+    */
+    void add(Point2 *handle)
+    {
+        if (!valid || !index.emplace(handle, uint32_t(handles.size())).second)
+        {
+            return;
+        }
+        handles.push_back(handle);
+        x.push_back(handle->x());
+        y.push_back(handle->y());
+    }
+
+    /*
+    Remove a vertex by moving the last one into its place. Call before Fade deletes it.
+    */
+    void remove(Point2 *handle)
+    {
+        auto it = valid ? index.find(handle) : index.end();
+        if (it == index.end())
+        {
+            return;
+        }
+        uint32_t i = it->second;
+        index.erase(it);
+        uint32_t last = uint32_t(handles.size() - 1);
+        if (i != last)
+        {
+            handles[i] = handles[last];
+            x[i] = x[last];
+            y[i] = y[last];
+            index[handles[i]] = i;
+        }
+        handles.pop_back();
+        x.pop_back();
+        y.pop_back();
+    }
+
+    /*
+    Indices of the vertices inside box, in snapshot order.
+    */
+    void filter(const Bbox2 &box, std::pmr::vector<uint32_t> &out) const
+    {
+        out.clear();
+        for (size_t first = 0; first < size(); first += 8)
+        {
+            size_t count = std::min<size_t>(8, size() - first);
+            for (uint32_t mask = inBox(first, count, box); mask != 0; mask &= mask - 1)
+            {
+                out.push_back(uint32_t(first + __builtin_ctz(mask)));
+            }
+        }
+    }
+
+    /*
+    Indices of the vertices inside each of boxes (out[b] for boxes[b], boxes may overlap),
+    in one pass: every block of 8 vertices is loaded once and tested against all boxes.
+    */
+    void filter(const std::pmr::vector<Bbox2> &boxes, std::pmr::vector<std::pmr::vector<uint32_t>> &out) const
+    {
+        for (auto &list : out)
+        {
+            list.clear();
+        }
+        for (size_t first = 0; first < size(); first += 8)
+        {
+            size_t count = std::min<size_t>(8, size() - first);
+            for (size_t b = 0; b < boxes.size(); ++b)
+            {
+                for (uint32_t mask = inBox(first, count, boxes[b]); mask != 0; mask &= mask - 1)
+                {
+                    out[b].push_back(uint32_t(first + __builtin_ctz(mask)));
+                }
+            }
+        }
+    }
+};
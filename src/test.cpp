@@ -1,9 +1,1144 @@
-#include <Fade_2D.h>
-using namespace GEOM_FADE2D;
+#include <filesystem>
 
-int main() {
+#include "seams.hpp"
+#include "sfc.hpp"
+#include "checkpoint.hpp"
+#include "output.hpp"
+#include "transport.hpp"
+#include "threaded.hpp"
+#include "quality.hpp"
+
+// Unit tests, without MPI but for halo_transports: `dmr_test <name>` runs one (as ctest does), no argument runs all.
+
+#define CHECK(condition)                                                                   \
+    if (!(condition))                                                                      \
+    {                                                                                      \
+        std::cout << __FILE__ << ":" << __LINE__ << " failed: " #condition << std::endl; \
+        return false;                                                                      \
+    }
+
+/*
+Deterministic random points in [0, size]^2 plus the corners, so the domain is the full square.
+*/
+std::vector<Point2> randomPoints(size_t count, double size = 100, unsigned seed = 1)
+{
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> coordinate(0, size);
+    std::vector<Point2> points = {Point2(0, 0), Point2(size, 0), Point2(size, size), Point2(0, size)};
+    for (size_t i = 0; i < count; ++i)
+    {
+        points.push_back(Point2(coordinate(generator), coordinate(generator)));
+    }
+    return points;
+}
+
+RuntimeParameters testParameters()
+{
+    char name[] = "dmr_test";
+    char *argv[] = {name};
+    return RuntimeParameters(1, argv);
+}
+
+/*
+Closed counterclockwise square polygon.
+*/
+std::vector<Segment2> square(double minX, double minY, double size)
+{
+    Point2 corners[4] = {Point2(minX, minY), Point2(minX + size, minY), Point2(minX + size, minY + size), Point2(minX, minY + size)};
+    std::vector<Segment2> polygon;
+    for (int i = 0; i < 4; ++i)
+    {
+        polygon.push_back(Segment2(corners[i], corners[(i + 1) % 4]));
+    }
+    return polygon;
+}
+
+/*
+Number of triangles of localMesh whose barycenter it owns.
+*/
+size_t ownedTriangles(LocalMesh &localMesh)
+{
+    std::vector<Triangle2 *> triangles;
+    localMesh.mesh.getTrianglePointers(triangles);
+    return std::count_if(triangles.begin(), triangles.end(),
+                         [&](Triangle2 *triangle) { return ownsPoint(localMesh.bbox, triangle->getBarycenter()); });
+}
+
+double triangleArea(Triangle2 *triangle)
+{
+    Point2 &p0 = *triangle->getCorner(0), &p1 = *triangle->getCorner(1), &p2 = *triangle->getCorner(2);
+    return 0.5 * std::fabs((p1.x() - p0.x()) * (p2.y() - p0.y()) - (p2.x() - p0.x()) * (p1.y() - p0.y()));
+}
+
+bool testFadeCopy()
+{
     Fade_2D obj1;
-    Fade_2D obj2 = obj1;  // Test copy constructor
-    //Fade_2D obj3 = std::move(obj1);  // Test move constructor
-    return 0;
-}
\ No newline at end of file
+    Fade_2D obj2 = obj1; // Test copy constructor
+    return true;
+}
+
+/*
+The chosen grid shape has the least halo area of all factorizations of the block count:
+a long domain is cut across its long side, a square one into the most square grid, and a
+prime count into a single row or column.
+*/
+bool testGridShape()
+{
+    for (auto [width, height] : {std::pair<double, double>{100, 100}, {400, 100}, {100, 300}})
+    {
+        Bbox2 domain;
+        domain.add(Point2(0, 0));
+        domain.add(Point2(width, height));
+        for (int numBlocks : {1, 4, 7, 12, 36})
+        {
+            int cols, rows;
+            chooseGridShape(numBlocks, domain, 1.5, cols, rows);
+            CHECK(cols * rows == numBlocks);
+            for (int c = 1; c <= numBlocks; ++c)
+            {
+                if (numBlocks % c == 0)
+                {
+                    CHECK(gridHaloArea(cols, rows, domain, 1.5) <= gridHaloArea(c, numBlocks / c, domain, 1.5));
+                }
+            }
+        }
+        int cols, rows;
+        chooseGridShape(7, domain, 1.5, cols, rows);
+        CHECK(cols == 1 || rows == 1);
+    }
+
+    Bbox2 square, wide;
+    square.add(Point2(0, 0));
+    square.add(Point2(100, 100));
+    wide.add(Point2(0, 0));
+    wide.add(Point2(400, 100));
+    int cols, rows;
+    chooseGridShape(36, square, 1.5, cols, rows);
+    CHECK(cols == 6 && rows == 6);
+    chooseGridShape(4, wide, 1.5, cols, rows);
+    CHECK(cols == 4 && rows == 1);
+    CHECK(gridHaloArea(4, 1, wide, 1.5) == 2 * 2 * 1.5 * 3 * 100);
+    return true;
+}
+
+/*
+The blocks of a fresh split are cut from one Delaunay triangulation with a 2r halo,
+so their seams agree: no gaps, no triangle owned twice, no empty circle violated.
+*/
+bool testSeamsTwoBlocks()
+{
+    GlobalMesh globalMesh(testParameters());
+    std::vector<Point2> points = randomPoints(2000);
+    bulkInsert(globalMesh.mesh, points, InsertionOrder::Fade);
+    globalMesh.layoutBlocks(2);
+    CHECK(globalMesh.grid.cols() * globalMesh.grid.rows() == 2);
+
+    std::vector<LocalMesh> blocks(2);
+    std::vector<std::optional<BlockSeams>> seams(2);
+    std::vector<std::pmr::unordered_map<Neighbor, HaloPayload>> payloads;
+    for (size_t b = 0; b < 2; ++b)
+    {
+        globalMesh.fillBlock(b, blocks[b]);
+        blocks[b].arena.reset();
+        seams[b].emplace(blocks[b].arena.resource());
+        payloads.emplace_back(blocks[b].arena.resource());
+        collectSeams(blocks[b], *seams[b], payloads[b]);
+        CHECK(seams[b]->sides.size() == 1);
+    }
+
+    SeamStats stats;
+    for (size_t b = 0; b < 2; ++b)
+    {
+        auto &[direction, payload] = *payloads[1 - b].begin();
+        CHECK(!payload.segments.empty());
+        checkSeam(blocks[b], *seams[b], opposite(direction), payload, stats);
+        stats.edges += seams[b]->sides.begin()->second.edges.size();
+    }
+    CHECK(stats.edges > 0);
+    CHECK(stats.mismatched == 0);
+    CHECK(stats.duplicated == 0);
+    CHECK(stats.violations == 0);
+    return true;
+}
+
+/*
+Splitting a segment at grid lines keeps it contiguous and its length, and no piece crosses a line.
+*/
+bool testConstraintSplit()
+{
+    std::vector<double> xLines = {10, 20, 30}, yLines = {5, 15};
+    Segment2 segment(Point2(1, 0), Point2(39, 18));
+    std::vector<Segment2> pieces = splitSegments({segment}, xLines, yLines);
+    CHECK(pieces.size() == 6);
+    double length = 0;
+    for (size_t i = 0; i < pieces.size(); ++i)
+    {
+        Point2 src = pieces[i].getSrc(), trg = pieces[i].getTrg();
+        length += std::sqrt(sqDistance2D(src, trg));
+        if (i > 0)
+        {
+            CHECK(src.x() == pieces[i - 1].getTrg().x() && src.y() == pieces[i - 1].getTrg().y());
+        }
+        for (double x : xLines)
+        {
+            CHECK(!(std::min(src.x(), trg.x()) + 1e-9 < x && x < std::max(src.x(), trg.x()) - 1e-9));
+        }
+        for (double y : yLines)
+        {
+            CHECK(!(std::min(src.y(), trg.y()) + 1e-9 < y && y < std::max(src.y(), trg.y()) - 1e-9));
+        }
+    }
+    CHECK(pieces.front().getSrc().x() == 1 && pieces.back().getTrg().x() == 39);
+    CHECK(std::fabs(length - std::sqrt(38.0 * 38 + 18 * 18)) < 1e-9);
+
+    std::vector<Segment2> restored = unflattenSegments(flattenSegments(pieces));
+    CHECK(restored.size() == pieces.size());
+    CHECK(restored[3].getSrc().x() == pieces[3].getSrc().x() && restored[3].getTrg().y() == pieces[3].getTrg().y());
+    return true;
+}
+
+/*
+Every block decides inside/outside from its clipped pieces plus its exterior parity
+exactly as the even-odd rule over the whole boundary does, in the hole, around it and outside.
+*/
+bool testConstraintParity()
+{
+    GlobalMesh globalMesh(testParameters());
+    std::vector<Segment2> outer = square(10, 10, 80), hole = square(35, 40, 20);
+    globalMesh.addBoundary(outer);
+    globalMesh.addBoundary(hole);
+    std::vector<Point2> points = randomPoints(500);
+    bulkInsert(globalMesh.mesh, points, InsertionOrder::Fade);
+    globalMesh.layoutBlocks(6);
+
+    std::vector<LocalMesh> blocks(6);
+    std::mt19937 generator(2);
+    std::uniform_real_distribution<double> unit(0, 1);
+    size_t inside = 0, outside = 0;
+    for (size_t b = 0; b < blocks.size(); ++b)
+    {
+        globalMesh.fillBlock(b, blocks[b]);
+        CHECK(blocks[b].constrained);
+        const Bbox2 &bbox = blocks[b].bbox;
+        for (int i = 0; i < 500; ++i)
+        {
+            Point2 p(bbox.get_minX() + unit(generator) * bbox.getRangeX(), bbox.get_minY() + unit(generator) * bbox.getRangeY());
+            bool expected = false;
+            for (auto &segment : globalMesh.boundarySegments)
+            {
+                expected = expected != crossesRay(segment, p.x(), p.y());
+            }
+            CHECK(blocks[b].isInsideDomain(p) == expected);
+            (expected ? inside : outside) += 1;
+        }
+    }
+    CHECK(inside > 0 && outside > 0);
+    return true;
+}
+
+/*
+Mesh a square domain with a square hole: the refined domain triangles tile exactly the
+area between the two squares, none lies in the hole and all meet the angle bound.
+*/
+bool testHoleDomain()
+{
+    GlobalMesh globalMesh(testParameters());
+    std::vector<Segment2> outer = square(0, 0, 100), hole = square(40, 30, 20);
+    globalMesh.addBoundary(outer);
+    globalMesh.addBoundary(hole);
+    globalMesh.refineMesh();
+    globalMesh.layoutBlocks(1);
+
+    LocalMesh localMesh;
+    globalMesh.fillBlock(0, localMesh);
+    localMesh.refineBbox(localMesh.bbox);
+    CHECK(localMesh.badTriangles(localMesh.bbox) == 0);
+
+    std::vector<Triangle2 *> triangles;
+    localMesh.mesh.getTrianglePointers(triangles);
+    double area = 0;
+    for (auto &triangle : triangles)
+    {
+        Point2 barycenter = triangle->getBarycenter();
+        bool inHole = barycenter.x() > 40 && barycenter.x() < 60 && barycenter.y() > 30 && barycenter.y() < 50;
+        if (localMesh.isInsideDomain(barycenter))
+        {
+            CHECK(!inHole);
+            area += triangleArea(triangle);
+        }
+        else
+        {
+            CHECK(inHole);
+        }
+    }
+    CHECK(std::fabs(area - (100 * 100 - 20 * 20)) < 1e-6);
+    return true;
+}
+
+/*
+The 8 x 8 corner of the key grid is the first sub-curve of both curves: its keys are
+exactly 0..63, and consecutive Hilbert keys are neighbouring cells.
+*/
+bool testSfcKeys()
+{
+    const uint32_t side = 8;
+    std::vector<std::pair<uint32_t, uint32_t>> hilbertCells(side * side), mortonCells(side * side);
+    std::vector<bool> hilbertSeen(side * side, false), mortonSeen(side * side, false);
+    for (uint32_t x = 0; x < side; ++x)
+    {
+        for (uint32_t y = 0; y < side; ++y)
+        {
+            uint64_t hilbert = hilbertKey(x, y), morton = mortonKey(x, y);
+            CHECK(hilbert < side * side && !hilbertSeen[hilbert]);
+            CHECK(morton < side * side && !mortonSeen[morton]);
+            hilbertSeen[hilbert] = mortonSeen[morton] = true;
+            hilbertCells[hilbert] = {x, y};
+        }
+    }
+    for (size_t key = 1; key < hilbertCells.size(); ++key)
+    {
+        auto [x0, y0] = hilbertCells[key - 1];
+        auto [x1, y1] = hilbertCells[key];
+        CHECK(std::abs(int(x1) - int(x0)) + std::abs(int(y1) - int(y0)) == 1);
+    }
+    CHECK(mortonKey(1, 0) == 1 && mortonKey(0, 1) == 2 && mortonKey(1, 1) == 3);
+    CHECK(mortonKey(0xFFFFFFFFu, 0xFFFFFFFFu) == ~0ull);
+
+    Bbox2 domain;
+    domain.add(Point2(0, 0));
+    domain.add(Point2(100, 50));
+    SfcQuantizer quantizer(domain, Curve::Hilbert);
+    CHECK(quantizer.quantize(-1, quantizer.minX) == 0 && quantizer.quantize(100, quantizer.minX) == 0xFFFFFFFFu);
+    return true;
+}
+
+/*
+The insertion keys (SIMD and scalar tail alike) are the 16 bit Morton keys of the clamped,
+quantized points, and the radix sort orders (key, index) entries as std::sort does,
+also when every key is the same and all passes are skipped.
+*/
+bool testInsertionKeys()
+{
+    std::mt19937 generator(3);
+    std::uniform_real_distribution<double> coordinate(-10, 110);
+    const size_t n = 1003;
+    std::vector<double> x(n), y(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        x[i] = coordinate(generator);
+        y[i] = coordinate(generator);
+    }
+    const double scale = 65535.0 / 100;
+    std::vector<uint32_t> keys(n);
+    computeInsertionKeys(x.data(), y.data(), n, 0, 0, scale, keys.data());
+    for (size_t i = 0; i < n; ++i)
+    {
+        double qx = std::min(std::max(x[i] * scale, 0.0), 65535.0), qy = std::min(std::max(y[i] * scale, 0.0), 65535.0);
+        CHECK(keys[i] == uint32_t(mortonKey(uint32_t(qx), uint32_t(qy))));
+    }
+
+    for (uint32_t same : {0u, 1u})
+    {
+        std::vector<uint64_t> entries(n), buffer(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            entries[i] = (uint64_t(same ? 7 : keys[i]) << 32) | i;
+        }
+        std::vector<uint64_t> expected = entries;
+        std::sort(expected.begin(), expected.end());
+        radixSortByKey(entries.data(), n, buffer.data());
+        CHECK(entries == expected);
+    }
+    radixSortByKey(nullptr, 0, nullptr);
+    return true;
+}
+
+/*
+The vectorized snapshot filters find exactly the vertices a scalar loop finds, box bounds
+included, for one box and for overlapping boxes at once, also after removals reorder it
+and with a vertex count that leaves a partial block of 8.
+*/
+bool testSnapshotFilter()
+{
+    Fade_2D mesh;
+    std::vector<Point2> points = randomPoints(1002);
+    points.insert(points.end(), {Point2(20, 40), Point2(60, 70), Point2(20, 30), Point2(45, 70)}); // on the bounds of the first box
+    bulkInsert(mesh, points, InsertionOrder::Fade);
+    VertexSnapshot snapshot;
+    snapshot.sync(mesh);
+    CHECK(snapshot.size() == mesh.numberOfPoints() && snapshot.size() % 8 != 0);
+
+    std::pmr::vector<Bbox2> boxes;
+    for (auto [minX, minY, maxX, maxY] : {std::array<double, 4>{20, 30, 60, 70}, {0, 0, 100, 5}, {50, 50, 90, 100}, {200, 200, 300, 300}})
+    {
+        Bbox2 box;
+        box.add(Point2(minX, minY));
+        box.add(Point2(maxX, maxY));
+        boxes.push_back(box);
+    }
+    for (int round = 0; round < 2; ++round)
+    {
+        std::pmr::vector<std::pmr::vector<uint32_t>> lists(boxes.size());
+        snapshot.filter(boxes, lists);
+        for (size_t b = 0; b < boxes.size(); ++b)
+        {
+            std::pmr::vector<uint32_t> expected, single;
+            for (uint32_t i = 0; i < snapshot.size(); ++i)
+            {
+                if (snapshot.x[i] >= boxes[b].get_minX() && snapshot.x[i] <= boxes[b].get_maxX() &&
+                    snapshot.y[i] >= boxes[b].get_minY() && snapshot.y[i] <= boxes[b].get_maxY())
+                {
+                    expected.push_back(i);
+                }
+            }
+            snapshot.filter(boxes[b], single);
+            CHECK(single == expected && lists[b] == expected);
+            CHECK(b + 1 < boxes.size() ? !expected.empty() : expected.empty());
+        }
+        // every third vertex leaves, the last ones move into the gaps
+        std::vector<Point2 *> handles = snapshot.handles;
+        for (size_t i = 0; i < handles.size(); i += 3)
+        {
+            snapshot.remove(handles[i]);
+        }
+        CHECK(snapshot.size() == handles.size() - (handles.size() + 2) / 3 && snapshot.size() % 8 != 0);
+    }
+    return true;
+}
+
+/*
+Merging the curve-sorted blocks of a two-block split gives back the global triangulation:
+every triangle once, every vertex once (seam vertices are shared by both parts), valid indices.
+*/
+bool testSfcMerge()
+{
+    GlobalMesh globalMesh(testParameters());
+    std::vector<Point2> points = randomPoints(2000);
+    bulkInsert(globalMesh.mesh, points, InsertionOrder::Fade);
+    globalMesh.layoutBlocks(2);
+    SfcQuantizer quantizer(globalMesh.mesh.computeBoundingBox(), Curve::Hilbert);
+
+    std::vector<SortedMesh> parts;
+    size_t partVertices = 0;
+    for (size_t b = 0; b < 2; ++b)
+    {
+        LocalMesh block;
+        globalMesh.fillBlock(b, block);
+        parts.push_back(sortOwnedTriangles(block.mesh, block.bbox, quantizer));
+        CHECK(std::is_sorted(parts[b].vertexKeys.begin(), parts[b].vertexKeys.end()));
+        CHECK(std::is_sorted(parts[b].triangleKeys.begin(), parts[b].triangleKeys.end()));
+        partVertices += parts[b].vertexKeys.size();
+    }
+
+    SortedMesh merged;
+    CHECK(mergeSortedMeshes(parts, merged));
+    size_t numPoints = merged.coordinates.size() / 2;
+    CHECK(merged.triangles.size() / 3 == globalMesh.mesh.numberOfTriangles());
+    CHECK(numPoints == globalMesh.mesh.numberOfPoints());
+    CHECK(numPoints < partVertices);
+    CHECK(std::is_sorted(merged.triangleKeys.begin(), merged.triangleKeys.end()));
+    for (uint32_t index : merged.triangles)
+    {
+        CHECK(index < numPoints);
+    }
+    return true;
+}
+
+/*
+Stitching the part files of a four-block split, two blocks per part as two ranks write them
+on eviction, gives the vertices of mergeSortedMeshes and the same triangles; the parts are removed.
+*/
+bool testMeshParts()
+{
+    std::string path = (std::filesystem::temp_directory_path() / "dmr_test_parts.ply").string();
+    GlobalMesh globalMesh(testParameters());
+    std::vector<Point2> points = randomPoints(2000);
+    bulkInsert(globalMesh.mesh, points, InsertionOrder::Fade);
+    globalMesh.layoutBlocks(4);
+    SfcQuantizer quantizer(globalMesh.mesh.computeBoundingBox(), Curve::Hilbert);
+
+    std::vector<SortedMesh> pieces;
+    for (size_t b = 0; b < 4; ++b)
+    {
+        LocalMesh block;
+        globalMesh.fillBlock(b, block);
+        pieces.push_back(sortOwnedTriangles(block.mesh, block.bbox, quantizer));
+    }
+    for (int rank = 0; rank < 2; ++rank)
+    {
+        std::ofstream part(meshPartPath(path, rank), std::ios::binary);
+        CHECK(appendMeshPart(part, pieces[2 * rank]) && appendMeshPart(part, pieces[2 * rank + 1]));
+    }
+    CHECK(stitchMeshParts(path, 2));
+    CHECK(!std::filesystem::exists(meshPartPath(path, 0)) && !std::filesystem::exists(meshPartPath(path, 1)));
+    SortedMesh merged;
+    CHECK(mergeSortedMeshes(pieces, merged));
+
+    std::ifstream in(path, std::ios::binary);
+    std::string line;
+    size_t numVertices = 0, numFaces = 0;
+    while (std::getline(in, line) && line != "end_header")
+    {
+        if (line.rfind("element vertex ", 0) == 0) numVertices = std::stoul(line.substr(15));
+        if (line.rfind("element face ", 0) == 0) numFaces = std::stoul(line.substr(13));
+    }
+    CHECK(numVertices == merged.coordinates.size() / 2 && numFaces == merged.triangles.size() / 3);
+    for (size_t i = 0; i < numVertices; ++i)
+    {
+        double x, y, z;
+        CHECK(readBinary(in, x) && readBinary(in, y) && readBinary(in, z));
+        CHECK(x == merged.coordinates[2 * i] && y == merged.coordinates[2 * i + 1]);
+    }
+    std::vector<std::array<uint32_t, 3>> stitched, expected;
+    for (size_t t = 0; t < numFaces; ++t)
+    {
+        uint8_t corners;
+        std::array<uint32_t, 3> triangle;
+        CHECK(readBinary(in, corners) && corners == 3 && readBinary(in, triangle));
+        stitched.push_back(triangle);
+        expected.push_back({merged.triangles[3 * t], merged.triangles[3 * t + 1], merged.triangles[3 * t + 2]});
+    }
+    std::sort(stitched.begin(), stitched.end());
+    std::sort(expected.begin(), expected.end());
+    CHECK(stitched == expected);
+    in.close();
+    std::filesystem::remove(path);
+    return true;
+}
+
+/*
+A pre-refined mesh saved with a block table loads back whole (every triangle once) and per
+block as fillBlock builds it; truncated files and missing blocks are rejected.
+*/
+bool testBinaryMesh()
+{
+    std::string path = (std::filesystem::temp_directory_path() / "dmr_test_mesh.bin").string();
+    std::string truncated = path + ".truncated";
+    GlobalMesh globalMesh(testParameters());
+    std::vector<Point2> points = randomPoints(2000);
+    bulkInsert(globalMesh.mesh, points, InsertionOrder::Fade);
+    globalMesh.refineMesh();
+    globalMesh.layoutBlocks(4);
+    CHECK(globalMesh.saveToBinary(path, true));
+
+    GlobalMesh loaded(testParameters());
+    CHECK(loaded.loadFromBinary(path));
+    CHECK(loaded.mesh.numberOfTriangles() == globalMesh.mesh.numberOfTriangles());
+    CHECK(loaded.mesh.numberOfPoints() == globalMesh.mesh.numberOfPoints());
+
+    double maxCircumradius = 0;
+    for (size_t b = 0; b < 4; ++b)
+    {
+        LocalMesh filled, mapped;
+        globalMesh.fillBlock(b, filled);
+        CHECK(mapped.loadFromBinary(path, b));
+        CHECK(mapped.bbox.get_minX() == filled.bbox.get_minX() && mapped.bbox.get_maxY() == filled.bbox.get_maxY());
+        for (Neighbor neighbor : allNeighbors)
+        {
+            CHECK(mapped.neighbors[neighbor] == filled.neighbors[neighbor]);
+        }
+        CHECK(ownedTriangles(mapped) == ownedTriangles(filled));
+        maxCircumradius = std::max(maxCircumradius, mapped.maxCircumradius);
+    }
+    CHECK(std::fabs(maxCircumradius - globalMesh.grid.r) < 1e-6 * globalMesh.grid.r);
+
+    MappedMesh mapped;
+    CHECK(mapped.openFile(path));
+    BlockGrid grid = mapped.blockGrid();
+    CHECK(grid.xEdges == globalMesh.grid.xEdges && grid.yEdges == globalMesh.grid.yEdges);
+    CHECK(!mapped.openBlock(path, 4));
+    std::filesystem::copy_file(path, truncated, std::filesystem::copy_options::overwrite_existing);
+    std::filesystem::resize_file(truncated, std::filesystem::file_size(path) - 64);
+    CHECK(!mapped.open(truncated));
+    CHECK(!mapped.openBlock(truncated, 0));
+    std::filesystem::remove(path);
+    std::filesystem::remove(truncated);
+    return true;
+}
+
+/*
+A refined block of a constrained domain survives a checkpoint: layout, boundary, vertices
+and triangulation come back; checkpoints of another rank or truncated ones are rejected.
+*/
+bool testCheckpoint()
+{
+    std::string path = (std::filesystem::temp_directory_path() / "dmr_test.ckpt").string();
+    GlobalMesh globalMesh(testParameters());
+    std::vector<Segment2> outer = square(0, 0, 100), hole = square(40, 30, 20);
+    globalMesh.addBoundary(outer);
+    globalMesh.addBoundary(hole);
+    globalMesh.refineMesh();
+    globalMesh.layoutBlocks(2);
+
+    LocalMesh saved, restored;
+    globalMesh.fillBlock(0, saved);
+    saved.refineBbox(saved.bbox);
+    CHECK(saveCheckpoint(saved, path, 3, 0, 2));
+    CHECK(loadCheckpoint(restored, path, 3, 0, 2));
+
+    CHECK(restored.bbox.get_minX() == saved.bbox.get_minX() && restored.bbox.get_maxY() == saved.bbox.get_maxY());
+    CHECK(restored.maxCircumradius == saved.maxCircumradius);
+    for (Neighbor neighbor : allNeighbors)
+    {
+        CHECK(restored.neighbors[neighbor] == saved.neighbors[neighbor]);
+    }
+    CHECK(restored.constrained && restored.constraints.size() == saved.constraints.size());
+    CHECK(restored.mesh.numberOfPoints() == saved.mesh.numberOfPoints());
+    CHECK(restored.mesh.numberOfTriangles() == saved.mesh.numberOfTriangles());
+    CHECK(restored.badTriangles(restored.bbox) == 0);
+    std::mt19937 generator(3);
+    std::uniform_real_distribution<double> coordinate(-10, 110);
+    for (int i = 0; i < 1000; ++i)
+    {
+        Point2 p(coordinate(generator), coordinate(generator));
+        CHECK(restored.isInsideDomain(p) == saved.isInsideDomain(p));
+    }
+
+    LocalMesh other;
+    CHECK(!loadCheckpoint(other, path, 3, 1, 2));
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 8);
+    LocalMesh truncated;
+    CHECK(!loadCheckpoint(truncated, path, 3, 0, 2));
+    std::filesystem::remove(path);
+    return true;
+}
+
+/*
+Halo payloads survive the flat wire format: a block's halo with boundary pieces, a terrain
+halo with heights and an empty one with the converged flag; a buffer of the wrong length
+unpacks to nothing.
+*/
+bool testHaloPacking()
+{
+    GlobalMesh globalMesh(testParameters());
+    std::vector<Segment2> outer = square(0, 0, 100), hole = square(40, 30, 20);
+    globalMesh.addBoundary(outer);
+    globalMesh.addBoundary(hole);
+    std::vector<Point2> points = randomPoints(500);
+    bulkInsert(globalMesh.mesh, points, InsertionOrder::Fade);
+    globalMesh.layoutBlocks(1);
+    LocalMesh localMesh;
+    globalMesh.fillBlock(0, localMesh);
+    localMesh.arena.reset();
+    std::pmr::vector<Bbox2> boxes(localMesh.arena.resource());
+    boxes.push_back(localMesh.bbox);
+
+    HaloPayload terrain, empty;
+    empty.converged = true;
+    terrain.points.assign({Point2(1, 2), Point2(3, 4), Point2(5, 6)});
+    terrain.segments.push_back(Segment2(Point2(1, 2), Point2(3, 4)));
+    terrain.heights.assign({7, std::nan(""), 9});
+
+    std::vector<HaloPayload> payloads = {collectHalos(localMesh, boxes).front(), terrain, empty};
+    CHECK(!payloads[0].points.empty() && !payloads[0].segments.empty());
+    for (auto &payload : payloads)
+    {
+        std::vector<double> wire;
+        packHalo(payload, wire);
+        CHECK(wire.size() * sizeof(double) == haloBytes(payload));
+        HaloPayload unpacked = unpackHalo(wire.data(), wire.size());
+        CHECK(unpacked.points.size() == payload.points.size() && unpacked.segments.size() == payload.segments.size());
+        CHECK(unpacked.heights.size() == payload.heights.size());
+        CHECK(unpacked.converged == payload.converged);
+        for (size_t i = 0; i < payload.points.size(); ++i)
+        {
+            CHECK(unpacked.points[i] == payload.points[i]);
+        }
+        for (size_t i = 0; i < payload.segments.size(); ++i)
+        {
+            CHECK(unpacked.segments[i].getSrc() == payload.segments[i].getSrc() && unpacked.segments[i].getTrg() == payload.segments[i].getTrg());
+        }
+        for (size_t i = 0; i < payload.heights.size(); ++i)
+        {
+            CHECK(unpacked.heights[i] == payload.heights[i] || (std::isnan(unpacked.heights[i]) && std::isnan(payload.heights[i])));
+        }
+        if (wire.size() > 2)
+        {
+            CHECK(unpackHalo(wire.data(), wire.size() - 1).points.empty());
+        }
+    }
+    return true;
+}
+
+/*
+The halos of all send boxes of a phase, collected in one pass, are those collected one
+box at a time: same points in the same order, same constraint pieces, corners that several
+(overlapping) boxes share in each of them.
+*/
+bool testCollectHalos()
+{
+    GlobalMesh globalMesh(testParameters());
+    std::vector<Segment2> outer = square(0, 0, 100), hole = square(40, 30, 20);
+    globalMesh.addBoundary(outer);
+    globalMesh.addBoundary(hole);
+    std::vector<Point2> points = randomPoints(2000);
+    bulkInsert(globalMesh.mesh, points, InsertionOrder::Fade);
+    globalMesh.layoutBlocks(4);
+    LocalMesh localMesh;
+    globalMesh.fillBlock(0, localMesh);
+
+    size_t checked = 0;
+    for (auto &taskGroup : initializeTaskGroups())
+    {
+        localMesh.arena.reset();
+        std::pmr::vector<Bbox2> boxes(localMesh.arena.resource());
+        for (auto &task : taskGroup.sendTasks)
+        {
+            boxes.push_back(task.bbox(&localMesh.bbox, localMesh.maxCircumradius));
+        }
+        std::pmr::vector<HaloPayload> together = collectHalos(localMesh, boxes);
+        CHECK(together.size() == boxes.size());
+        for (size_t b = 0; b < boxes.size(); ++b)
+        {
+            std::pmr::vector<Bbox2> box(1, boxes[b], localMesh.arena.resource());
+            HaloPayload alone = std::move(collectHalos(localMesh, box).front());
+            CHECK(together[b].points.size() == alone.points.size() && together[b].segments.size() == alone.segments.size());
+            for (size_t i = 0; i < alone.points.size(); ++i)
+            {
+                CHECK(together[b].points[i] == alone.points[i]);
+            }
+            for (size_t i = 0; i < alone.segments.size(); ++i)
+            {
+                CHECK(together[b].segments[i].getSrc() == alone.segments[i].getSrc() && together[b].segments[i].getTrg() == alone.segments[i].getTrg());
+            }
+            checked += alone.points.size();
+        }
+    }
+    CHECK(checked > 0);
+    return true;
+}
+
+/*
+Run with two MPI ranks (see CMakeLists.txt), the blocks of a 2 x 1 grid: over the graph and the
+raw transport each rank receives the points and pieces of the other as over Boost, in every
+phase, and the converged flag Boost has no room for.
+*/
+bool testHaloTransports()
+{
+    mpi::environment env;
+    mpi::communicator world;
+    if (world.size() != 2)
+    {
+        std::cout << "halo_transports needs two MPI ranks, skipped" << std::endl;
+        return true;
+    }
+    LocalMesh localMesh;
+    localMesh.setGridNeighbors(0, world.rank(), 2, 1);
+    Neighbor target = world.rank() == 0 ? Neighbor::Right : Neighbor::Left;
+
+    // the halo rank sends, sorted for the comparison
+    auto halo = [](int rank)
+    {
+        HaloPayload payload;
+        std::vector<Point2> points = randomPoints(200, 100, unsigned(rank + 1));
+        payload.points.assign(points.begin(), points.end());
+        for (size_t i = 0; i + 1 < 20; ++i)
+        {
+            payload.segments.push_back(Segment2(points[i], points[i + 1]));
+        }
+        return payload;
+    };
+    using Received = std::pair<std::vector<std::pair<double, double>>, std::vector<std::array<double, 4>>>;
+    auto sorted = [](const HaloPayload &payload)
+    {
+        Received received;
+        for (auto &point : payload.points)
+        {
+            received.first.emplace_back(point.x(), point.y());
+        }
+        for (auto &segment : payload.segments)
+        {
+            received.second.push_back({segment.getSrc().x(), segment.getSrc().y(), segment.getTrg().x(), segment.getTrg().y()});
+        }
+        std::sort(received.first.begin(), received.first.end());
+        std::sort(received.second.begin(), received.second.end());
+        return received;
+    };
+    Received expected = sorted(halo(1 - world.rank()));
+
+    int phase = 0;
+    for (std::string name : {"boost", "graph", "raw"})
+    {
+        std::unique_ptr<HaloTransport> transport = makeHaloTransport(name, world, localMesh, testParameters());
+        for (int round = 0; round < 2; ++round, ++phase)
+        {
+            HaloPayload payload = halo(world.rank());
+            payload.converged = true;
+            size_t deliveries = 0;
+            transport->postReceives(phase, {target});
+            transport->send(phase, target, std::move(payload));
+            bool matches = true;
+            transport->complete([&](Neighbor source, HaloPayload &received)
+                                {
+                                    deliveries += 1;
+                                    matches = matches && source == target && sorted(received) == expected &&
+                                              (name == "boost" || received.converged);
+                                });
+            CHECK(deliveries == 1 && matches);
+        }
+    }
+    return true;
+}
+
+/*
+Refining a terrain in two overlapping rounds keeps every vertex on the surface of the input
+samples: Steiner and height points of the first round don't become part of the surface the
+second measures against.
+*/
+bool testTerrainSamples()
+{
+    std::string path = (std::filesystem::temp_directory_path() / "dmr_test_terrain.xyz").string();
+    auto terrain = [](double x, double y) { return 10 * std::sin(x / 10) * std::cos(y / 10); };
+    {
+        std::ofstream samples(path);
+        for (int x = 0; x <= 100; x += 5)
+        {
+            for (int y = 0; y <= 100; y += 5)
+            {
+                samples << x << " " << y << " " << terrain(x, y) << "\n";
+            }
+        }
+    }
+    GlobalMesh globalMesh(testParameters());
+    CHECK(globalMesh.loadTerrain(path));
+    std::filesystem::remove(path);
+    globalMesh.layoutBlocks(1);
+    LocalMesh localMesh;
+    globalMesh.fillBlock(0, localMesh);
+    CHECK(localMesh.samples.size() == 3 * 21 * 21);
+    localMesh.heightTolerance = 0.05;
+
+    Bbox2 left = localMesh.bbox;
+    left.setMaxX(60);
+    localMesh.refineBbox(left);
+    localMesh.refineBbox(localMesh.bbox);
+
+    localMesh.arena.reset();
+    std::unique_ptr<TerrainSurface> surface = localMesh.terrainSurface(localMesh.bbox);
+    std::vector<Point2 *> vertices;
+    localMesh.mesh.getVertexPointers(vertices);
+    CHECK(vertices.size() > 21 * 21);
+    for (auto &vertex : vertices)
+    {
+        Triangle2 *source = surface->mesh.locate(*vertex);
+        CHECK(localMesh.heights.has(*vertex) && source != nullptr);
+        CHECK(std::fabs(localMesh.heights.at(*vertex) - interpolateHeight(surface->heights, source, *vertex)) < 1e-9);
+    }
+    return true;
+}
+
+/*
+Input of the backend comparison in CMakeLists.txt: random points written to backend_input.ply
+in the working directory, for dmr and dmr_threaded to refine on the same block grid.
+*/
+bool testBackendInput()
+{
+    std::vector<Point2> points = randomPoints(3000);
+    std::vector<Point2 *> handles;
+    for (auto &point : points)
+    {
+        handles.push_back(&point);
+    }
+    CHECK(writePointsPLY("backend_input.ply", handles, false));
+    return true;
+}
+
+/*
+A mailbox hands over the halo of each phase once, in phase order across the wrap of its ring:
+alone (take before post finds nothing) and with a producer thread running ahead of its
+consumer, which must wait for a slot instead of overwriting an untaken halo.
+*/
+bool testHaloMailbox()
+{
+    auto halo = [](int phase)
+    {
+        auto payload = std::make_unique<HaloPayload>();
+        payload->points.push_back(Point2(phase, 0));
+        return payload;
+    };
+    auto phaseOf = [](const std::unique_ptr<HaloPayload> &payload)
+    { return payload && payload->points.size() == 1 ? int(payload->points.front().x()) : -1; };
+
+    HaloMailbox mailbox;
+    CHECK(mailbox.take(0) == nullptr);
+    for (int round = 0; round < 3; ++round)
+    {
+        // the four phases of a full ring, every round reuses all slots
+        for (int phase = 4 * round; phase < 4 * round + 4; ++phase)
+        {
+            mailbox.post(phase, halo(phase));
+        }
+        for (int phase = 4 * round; phase < 4 * round + 4; ++phase)
+        {
+            CHECK(phaseOf(mailbox.take(phase)) == phase);
+            CHECK(mailbox.take(phase) == nullptr);
+        }
+    }
+
+    const int phases = 2000;
+    HaloMailbox shared;
+    std::thread producer([&]()
+                         {
+                             for (int phase = 0; phase < phases; ++phase)
+                             {
+                                 shared.post(phase, halo(phase));
+                             }
+                         });
+    bool ordered = true;
+    for (int phase = 0; phase < phases; ++phase)
+    {
+        std::unique_ptr<HaloPayload> payload;
+        while (!(payload = shared.take(phase)))
+        {
+            std::this_thread::yield();
+        }
+        ordered = ordered && phaseOf(payload) == phase;
+    }
+    producer.join();
+    CHECK(ordered);
+    return true;
+}
+
+/*
+The threaded backend on more cells than threads runs both steps of every phase once per cell,
+whichever worker takes or steals a cell, and refines each cell as a single thread does.
+*/
+bool testThreadedSchedule()
+{
+    const int numCells = 6;
+    std::vector<TaskGroup> taskGroups = initializeTaskGroups();
+    std::vector<std::vector<LocalMesh>> runs;
+    for (int numThreads : {3, 1})
+    {
+        GlobalMesh globalMesh(testParameters());
+        std::vector<Point2> points = randomPoints(1000);
+        bulkInsert(globalMesh.mesh, points, InsertionOrder::Fade);
+        runs.push_back(globalMesh.splitMesh(numCells));
+        CHECK(runs.back().size() == size_t(numCells));
+        ThreadedStats stats = runThreaded(runs.back(), taskGroups, numThreads);
+        CHECK(stats.cellSteps.size() == size_t(numCells));
+        for (size_t steps : stats.cellSteps)
+        {
+            CHECK(steps == 2 * taskGroups.size());
+        }
+    }
+    for (int cell = 0; cell < numCells; ++cell)
+    {
+        std::vector<std::pair<double, double>> coordinates[2];
+        for (int run = 0; run < 2; ++run)
+        {
+            std::vector<Point2 *> vertices;
+            runs[run][cell].mesh.getVertexPointers(vertices);
+            for (Point2 *vertex : vertices)
+            {
+                coordinates[run].emplace_back(vertex->x(), vertex->y());
+            }
+            std::sort(coordinates[run].begin(), coordinates[run].end());
+        }
+        CHECK(runs[0][cell].mesh.numberOfTriangles() == runs[1][cell].mesh.numberOfTriangles());
+        CHECK(coordinates[0] == coordinates[1]);
+    }
+    return true;
+}
+
+/*
+Quality measures and histograms of known triangles: an equilateral one, two right isosceles
+ones, a 30-60-90 one and a flat one with an 11.3 degree angle, five so the vectorized kernel
+also runs its scalar tail. A square split at its center gives four right isosceles triangles.
+*/
+bool testQualityReport()
+{
+    std::vector<std::array<Point2, 3>> corners = {
+        {Point2(0, 0), Point2(1, 0), Point2(0.5, std::sqrt(3) / 2)},
+        {Point2(0, 0), Point2(1, 0), Point2(0, 1)},
+        {Point2(0, 0), Point2(1, 0), Point2(0, std::sqrt(3))},
+        {Point2(0, 0), Point2(10, 0), Point2(5, 1)},
+        {Point2(0, 0), Point2(2, 0), Point2(0, 2)},
+    };
+    std::vector<double> a, b, c, area;
+    for (auto &[p0, p1, p2] : corners)
+    {
+        a.push_back(sqDistance2D(p1, p2));
+        b.push_back(sqDistance2D(p2, p0));
+        c.push_back(sqDistance2D(p0, p1));
+        area.push_back(0.5 * std::fabs((p1.x() - p0.x()) * (p2.y() - p0.y()) - (p2.x() - p0.x()) * (p1.y() - p0.y())));
+    }
+    TriangleMeasures measures(std::pmr::get_default_resource());
+    measures.area.assign(area.begin(), area.end());
+    measures.minAngle.resize(corners.size());
+    measures.radiusEdge.resize(corners.size());
+    triangleKernel(a.data(), b.data(), c.data(), area.data(), corners.size(), measures.minAngle.data(), measures.radiusEdge.data());
+    for (size_t i = 0; i < corners.size(); ++i)
+    {
+        measures.minAngle[i] = std::acos(std::clamp(measures.minAngle[i], -1.0, 1.0)) * 180 / M_PI;
+        measures.sides.insert(measures.sides.end(), {a[i], b[i], c[i]});
+    }
+    double flatAngle = std::atan(0.2) * 180 / M_PI, flatRatio = 13 / std::sqrt(26.0);
+    double angles[5] = {60, 45, 30, flatAngle, 45}, ratios[5] = {1 / std::sqrt(3), 1 / std::sqrt(2), 1, flatRatio, 1 / std::sqrt(2)};
+    for (size_t i = 0; i < corners.size(); ++i)
+    {
+        CHECK(std::fabs(measures.minAngle[i] - angles[i]) < 1e-9);
+        CHECK(std::fabs(measures.radiusEdge[i] - ratios[i]) < 1e-12);
+    }
+
+    QualityReport report;
+    report.addExtremes(measures);
+    report.addHistograms(measures);
+    CHECK(report.triangles == 5);
+    CHECK(std::fabs(report.minAngle - flatAngle) < 1e-9);
+    CHECK(std::fabs(report.maxRadiusEdge - flatRatio) < 1e-12);
+    CHECK(std::fabs(report.totalArea - (std::sqrt(3) / 4 + 0.5 + std::sqrt(3) / 2 + 5 + 2)) < 1e-12);
+    CHECK(report.minArea == std::sqrt(3) / 4 && report.maxArea == 5);
+    CHECK(std::fabs(report.minSide - 1) < 1e-12 && report.maxSide == 10);
+    auto total = [](const auto &histogram) { return std::accumulate(histogram.begin(), histogram.end(), uint64_t(0)); };
+    CHECK(total(report.angleHistogram) == 5 && total(report.ratioHistogram) == 5);
+    CHECK(total(report.areaHistogram) == 5 && total(report.sideHistogram) == 15);
+    CHECK(report.angleHistogram[59] == 1 && report.angleHistogram[11] == 1);
+    CHECK(report.ratioHistogram[5] == 1 && report.ratioHistogram[7] == 2 && report.ratioHistogram[25] == 1);
+    CHECK(report.areaHistogram[0] == 1 && report.areaHistogram[QualityReport::logBins - 1] == 1);
+    // the sides of length 1 (3 equilateral, 2 legs, 1 short side) and the single longest one
+    CHECK(report.sideHistogram[0] == 6 && report.sideHistogram[QualityReport::logBins - 1] == 1);
+
+    GlobalMesh globalMesh(testParameters());
+    std::vector<Point2> points = {Point2(0, 0), Point2(100, 0), Point2(100, 100), Point2(0, 100), Point2(50, 50)};
+    bulkInsert(globalMesh.mesh, points, InsertionOrder::Fade);
+    std::vector<LocalMesh> localMeshes = globalMesh.splitMesh(1);
+    CHECK(localMeshes.size() == 1);
+    TriangleMeasures square = measureTriangles(localMeshes[0]);
+    CHECK(square.area.size() == 4 && square.sides.size() == 12);
+    for (size_t i = 0; i < 4; ++i)
+    {
+        CHECK(std::fabs(square.minAngle[i] - 45) < 1e-9);
+        CHECK(std::fabs(square.radiusEdge[i] - 1 / std::sqrt(2)) < 1e-12);
+        CHECK(square.area[i] == 2500);
+    }
+    return true;
+}
+
+/*
+Laplacian smoothing moves only free vertices: no boundary or hole vertex gets a target, a
+free vertex goes to the mean of its neighbors, and after smoothing the boundary vertices
+are where they were and the domain area is unchanged.
+*/
+bool testLaplacianFixed()
+{
+    GlobalMesh globalMesh(testParameters());
+    std::vector<Segment2> outer = square(0, 0, 100), hole = square(40, 30, 20);
+    globalMesh.addBoundary(outer);
+    globalMesh.addBoundary(hole);
+    globalMesh.refineMesh();
+    globalMesh.layoutBlocks(1);
+    LocalMesh localMesh;
+    globalMesh.fillBlock(0, localMesh);
+    localMesh.refineBbox(localMesh.bbox);
+
+    auto domainArea = [&]()
+    {
+        std::vector<Triangle2 *> triangles;
+        localMesh.mesh.getTrianglePointers(triangles);
+        double area = 0;
+        for (auto &triangle : triangles)
+        {
+            area += localMesh.isInsideDomain(triangle->getBarycenter()) ? triangleArea(triangle) : 0;
+        }
+        return area;
+    };
+    auto coordinates = [&](bool constraint)
+    {
+        std::vector<Point2 *> vertices;
+        localMesh.mesh.getVertexPointers(vertices);
+        std::vector<std::pair<double, double>> result;
+        for (Point2 *vertex : vertices)
+        {
+            if (localMesh.mesh.isConstraint(vertex) == constraint)
+            {
+                result.emplace_back(vertex->x(), vertex->y());
+            }
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    };
+
+    std::vector<Point2 *> vertices;
+    localMesh.mesh.getVertexPointers(vertices);
+    size_t fixed = 0, movable = 0;
+    for (Point2 *vertex : vertices)
+    {
+        Point2 target;
+        bool moves = localMesh.laplacianTarget(vertex, localMesh.bbox, target);
+        if (localMesh.mesh.isConstraint(vertex))
+        {
+            CHECK(!moves);
+            fixed += 1;
+        }
+        else if (moves)
+        {
+            std::vector<Point2 *> neighbors;
+            localMesh.mesh.getIncidentVertices(vertex, neighbors);
+            double sumX = 0, sumY = 0;
+            for (Point2 *neighbor : neighbors)
+            {
+                sumX += neighbor->x();
+                sumY += neighbor->y();
+            }
+            CHECK(std::fabs(target.x() - sumX / neighbors.size()) < 1e-9 && std::fabs(target.y() - sumY / neighbors.size()) < 1e-9);
+            movable += 1;
+        }
+    }
+    CHECK(fixed >= 8 && movable > 0);
+
+    std::vector<std::pair<double, double>> boundary = coordinates(true), interior = coordinates(false);
+    localMesh.smoothBbox(localMesh.bbox);
+    CHECK(coordinates(true) == boundary);
+    CHECK(coordinates(false) != interior);
+    CHECK(std::fabs(domainArea() - (100 * 100 - 20 * 20)) < 1e-6);
+    return true;
+}
+
+const std::vector<std::pair<std::string, std::function<bool()>>> tests = {
+    {"fade_copy", testFadeCopy},
+    {"grid_shape", testGridShape},
+    {"constraint_split", testConstraintSplit},
+    {"constraint_parity", testConstraintParity},
+    {"hole_domain", testHoleDomain},
+    {"sfc_keys", testSfcKeys},
+    {"insertion_keys", testInsertionKeys},
+    {"snapshot_filter", testSnapshotFilter},
+    {"sfc_merge", testSfcMerge},
+    {"mesh_parts", testMeshParts},
+    {"halo_packing", testHaloPacking},
+    {"collect_halos", testCollectHalos},
+    {"halo_transports", testHaloTransports},
+    {"seams_two_blocks", testSeamsTwoBlocks},
+    {"binary_mesh", testBinaryMesh},
+    {"checkpoint", testCheckpoint},
+    {"terrain_samples", testTerrainSamples},
+    {"backend_input", testBackendInput},
+    {"halo_mailbox", testHaloMailbox},
+    {"threaded_schedule", testThreadedSchedule},
+    {"quality_report", testQualityReport},
+    {"laplacian_fixed", testLaplacianFixed},
+};
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+    bool found = argc < 2;
+    for (auto &[name, test] : tests)
+    {
+        if (argc >= 2 && name != argv[1])
+        {
+            continue;
+        }
+        found = true;
+        bool passed = test();
+        std::cout << (passed ? "PASS " : "FAIL ") << name << std::endl;
+        failed += passed ? 0 : 1;
+    }
+    if (!found)
+    {
+        std::cout << "Unknown test " << argv[1] << std::endl;
+        return 1;
+    }
+    return failed == 0 ? 0 : 1;
+}
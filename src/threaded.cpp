@@ -0,0 +1,100 @@
+#include "threaded.hpp"
+
+// Single process entry point: runs the same schedule as main.cpp on more LocalMeshes (cells)
+// than worker threads, with halos passed between cells, no MPI environment needed.
+int main(int argc, char** argv) {
+    // important variables
+    Timer timer;
+    RuntimeParameters runtimeParameters(argc, argv);
+    if (runtimeParameters.help) {
+        std::cout << usageText;
+        return 0;
+    }
+    std::vector<TaskGroup> taskGroups = initializeTaskGroups();
+    int numThreads = runtimeParameters.numThreads > 0 ? runtimeParameters.numThreads
+                                                      : std::max(1, int(std::thread::hardware_concurrency()));
+
+    // start timer for overall duration
+    timer.start("Total Time");
+
+    // load mesh file and perform initial sequential refinement
+    GlobalMesh globalMesh = GlobalMesh(runtimeParameters);
+    bool terrain = !runtimeParameters.terrainPath.empty();
+    if (terrain && !runtimeParameters.loadMeshPath.empty()) {
+        std::cout << "--terrain can't be combined with --load-mesh" << std::endl;
+        return 1;
+    }
+    if (!runtimeParameters.loadMeshPath.empty()) {
+        if (!globalMesh.loadFromBinary(runtimeParameters.loadMeshPath)) {
+            return 1;
+        }
+    } else if (!runtimeParameters.inFilePath.empty() && !globalMesh.loadPoints()) {
+        return 1;
+    }
+    if (terrain && !globalMesh.loadTerrain(runtimeParameters.terrainPath)) {
+        return 1;
+    }
+    if (!runtimeParameters.boundaryPath.empty() && !globalMesh.loadBoundary(runtimeParameters.boundaryPath)) {
+        return 1;
+    }
+    globalMesh.refineMesh();
+
+    // split globalMesh into the block grid of the MPI backend with numThreads ranks, neighbors are cell indices
+    std::vector<LocalMesh> localMeshes = globalMesh.splitMesh(runtimeParameters.numBlocks(numThreads));
+    if (!runtimeParameters.saveMeshPath.empty() && !globalMesh.saveToBinary(runtimeParameters.saveMeshPath, true)) {
+        return 1;
+    }
+    for (auto& localMesh : localMeshes) {
+        localMesh.arena = PhaseArena(runtimeParameters.arenaBytes);
+        localMesh.heightTolerance = runtimeParameters.heightTolerance;
+    }
+
+    // Start of Computation
+    timer.start("Parallel Compute Region");
+    HeapCalls::start();
+    ThreadedStats threadedStats = runThreaded(localMeshes, taskGroups, numThreads);
+    size_t heapCalls = HeapCalls::stop();
+    timer.stop("Parallel Compute Region");
+    std::vector<HaloStats>& haloStats = threadedStats.halo;
+
+    // cost of all bulk inserts and halo handoffs during the parallel region
+    for (auto& localMesh : localMeshes) {
+        localMesh.arena.reset(); // closes the last phase in the arena statistics
+    }
+    InsertionStats insertion;
+    HaloStats halo;
+    ArenaStats arena;
+    for (size_t cell = 0; cell < localMeshes.size(); ++cell) {
+        insertion.points += localMeshes[cell].insertionStats.points;
+        insertion.sortMilliseconds = std::max(insertion.sortMilliseconds, localMeshes[cell].insertionStats.sortMilliseconds);
+        insertion.insertMilliseconds = std::max(insertion.insertMilliseconds, localMeshes[cell].insertionStats.insertMilliseconds);
+        halo.messages += haloStats[cell].messages;
+        halo.bytes += haloStats[cell].bytes;
+        halo.milliseconds = std::max(halo.milliseconds, haloStats[cell].milliseconds);
+        arena.overflows += localMeshes[cell].arena.stats.overflows;
+        arena.growths += localMeshes[cell].arena.stats.growths;
+        arena.peakBytes = std::max(arena.peakBytes, localMeshes[cell].arena.stats.peakBytes);
+    }
+    std::cout << "Insertion [" << runtimeParameters.insertionOrder << "] " << insertion.points << " points, sort "
+              << insertion.sortMilliseconds << " ms, insert " << insertion.insertMilliseconds << " ms (slowest cell)" << std::endl;
+    std::cout << "Halo [threads] " << halo.messages << " messages, " << halo.bytes << " bytes, "
+              << halo.milliseconds << " ms (slowest cell)" << std::endl;
+    std::cout << "Arena " << arena.overflows << " overflow allocations, " << arena.growths << " growths, peak "
+              << arena.peakBytes << " bytes per phase (largest cell)" << std::endl;
+    std::cout << "Heap " << heapCalls << " allocations in the parallel region, Fade and halos included" << std::endl;
+    std::cout << "Cells " << localMeshes.size() << " on " << numThreads << " threads, " << threadedStats.steals
+              << " of " << threadedStats.steps << " cell steps stolen" << std::endl;
+
+    // only the curve-ordered output writes the heights of a terrain
+    if (!runtimeParameters.outputOrder.empty() || terrain) {
+        Curve curve = runtimeParameters.outputOrder == "morton" ? Curve::Morton : Curve::Hilbert;
+        saveCurveOrdered(localMeshes, runtimeParameters.outFilePath, curve, numThreads);
+    } else {
+        GlobalMesh outputMesh(runtimeParameters);
+        outputMesh.loadFromLocalMeshes(localMeshes);
+        outputMesh.saveToPLY();
+    }
+
+    timer.stop("Total Time");
+    return 0;
+}
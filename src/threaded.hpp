@@ -0,0 +1,334 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <barrier>
+#include <numeric>
+#include <thread>
+
+#include "halo.hpp"
+#include "sfc.hpp"
+
+// THREADED BACKEND
+
+/*
+Lock-free single-producer single-consumer mailbox of one ordered neighbor pair: the only
+producer is the neighbor in one direction, the only consumer the cell itself. A halo is a
+heap allocated batch handed over by ownership, posting and taking it is one pointer swap.
+There is one slot per phase modulo ringSize; a producer more than ringSize phases ahead
+of its consumer waits for the slot to be taken.
+*/
+class HaloMailbox
+{
+private:
+    static constexpr int ringSize = 4;
+    std::array<std::atomic<HaloPayload *>, ringSize> slots;
+
+public:
+    HaloMailbox()
+    {
+        for (auto &slot : slots)
+        {
+            slot.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    HaloMailbox(const HaloMailbox &) = delete;
+    HaloMailbox &operator=(const HaloMailbox &) = delete;
+
+    ~HaloMailbox()
+    {
+        for (auto &slot : slots)
+        {
+            delete slot.load(std::memory_order_relaxed);
+        }
+    }
+
+    void post(int phase, std::unique_ptr<HaloPayload> payload)
+    {
+        std::atomic<HaloPayload *> &slot = slots[phase % ringSize];
+        while (slot.load(std::memory_order_acquire) != nullptr)
+        {
+            std::this_thread::yield();
+        }
+        slot.store(payload.release(), std::memory_order_release);
+    }
+
+    /*
+    The halo of phase, nullptr if it has not been posted yet.
+    */
+    std::unique_ptr<HaloPayload> take(int phase)
+    {
+        std::atomic<HaloPayload *> &slot = slots[phase % ringSize];
+        if (slot.load(std::memory_order_relaxed) == nullptr)
+        {
+            return nullptr;
+        }
+        return std::unique_ptr<HaloPayload>(slot.exchange(nullptr, std::memory_order_acquire));
+    }
+};
+
+// incoming mailboxes of one cell, indexed by the direction of the sender
+using CellMailboxes = std::array<HaloMailbox, 8>;
+
+/*
+Halo transport between the cells of one process, cell i owns mailboxes[i].
+LocalMesh::neighbors hold cell indices instead of ranks. Halos are delivered in the
+order of the receive tasks (not arrival order), so a run is deterministic.
+*/
+class ThreadHaloTransport : public HaloTransport
+{
+private:
+    std::vector<CellMailboxes> &mailboxes;
+    CellMailboxes &incoming;
+    const LocalMesh &localMesh;
+
+    int phase = 0;
+    std::vector<Neighbor> sources;
+
+public:
+    ThreadHaloTransport(std::vector<CellMailboxes> &mailboxes, size_t cell, const LocalMesh &localMesh)
+        : mailboxes(mailboxes), incoming(mailboxes[cell]), localMesh(localMesh) {}
+
+    const char *name() const override { return "threads"; }
+
+    void postReceives(int phase, const std::vector<Neighbor> &sources) override
+    {
+        this->phase = phase;
+        this->sources = sources;
+    }
+
+    void send(int phase, Neighbor target, HaloPayload payload) override
+    {
+        HaloTimer timer(stats);
+        stats.messages += 1;
+        stats.bytes += haloBytes(payload);
+        size_t cell = localMesh.neighbors.at(target).value();
+        // the receiver sees this cell in the opposite direction
+        mailboxes[cell][int(opposite(target))].post(phase, std::make_unique<HaloPayload>(std::move(payload)));
+    }
+
+    void complete(const std::function<void(Neighbor, HaloPayload &)> &deliver) override
+    {
+        HaloTimer timer(stats);
+        for (Neighbor source : sources)
+        {
+            std::unique_ptr<HaloPayload> payload;
+            while (!(payload = incoming[int(source)].take(phase)))
+            {
+                std::this_thread::yield();
+            }
+            deliver(source, *payload);
+        }
+    }
+};
+
+/*
+The cells one worker starts a step with. The owner takes from the back, thieves take
+from the front. Both ends live in one atomic word (front in the high half), so every
+take is a single CAS and the owner and a thief can never get the same cell.
+*/
+class StealingDeque
+{
+private:
+    std::vector<size_t> cells;
+    std::atomic<uint64_t> ends{0};
+
+    bool take(size_t &cell, bool back)
+    {
+        uint64_t current = ends.load(std::memory_order_acquire);
+        while (true)
+        {
+            uint64_t front = current >> 32, end = current & 0xFFFFFFFFull;
+            if (front >= end)
+            {
+                return false;
+            }
+            uint64_t next = back ? (front << 32) | (end - 1) : ((front + 1) << 32) | end;
+            if (ends.compare_exchange_weak(current, next, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                cell = cells[back ? end - 1 : front];
+                return true;
+            }
+        }
+    }
+
+public:
+    /*
+    Refill with cells, only while no other worker can take (between two barriers).
+    */
+    void reset(const std::vector<size_t> &cells)
+    {
+        this->cells = cells;
+        ends.store(uint64_t(cells.size()), std::memory_order_release);
+    }
+
+    bool takeBack(size_t &cell) { return take(cell, true); }
+
+    bool stealFront(size_t &cell) { return take(cell, false); }
+};
+
+/*
+The contiguous run of cells worker thread of numThreads starts a step with.
+*/
+std::vector<size_t> ownCells(size_t numCells, int thread, int numThreads)
+{
+    std::vector<size_t> cells;
+    for (size_t cell = numCells * thread / numThreads; cell < numCells * (thread + 1) / numThreads; ++cell)
+    {
+        cells.push_back(cell);
+    }
+    return cells;
+}
+
+/*
+The next cell of worker thread: from the back of its own deque, else stolen from the front
+of another worker's (counted in steals). false once all deques are empty.
+*/
+bool nextCell(std::vector<StealingDeque> &deques, int thread, size_t &cell, std::atomic<size_t> &steals)
+{
+    if (deques[thread].takeBack(cell))
+    {
+        return true;
+    }
+    for (size_t victim = 1; victim < deques.size(); ++victim)
+    {
+        if (deques[(thread + victim) % deques.size()].stealFront(cell))
+        {
+            steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+struct ThreadedStats
+{
+    std::vector<HaloStats> halo;   // per cell
+    std::vector<size_t> cellSteps; // per cell, the steps it ran (two per phase)
+    size_t steps = 0;
+    size_t steals = 0;
+};
+
+/*
+Run the phases of the schedule on all local meshes (cells) with numThreads workers.
+Every phase has two steps: start (refine and send) and finish (apply the halos). Cells
+never share state within a step, so each step is one color of independent tasks, with a
+barrier between steps. Worker t starts a step with a contiguous run of cells, and
+once its deque is empty it steals from the others, so a cell with a heavily graded region
+does not leave the other workers waiting. With more cells than threads (see --blocks-per-rank)
+the imbalance left at the end of a step is at most one cell.
+*/
+ThreadedStats runThreaded(std::vector<LocalMesh> &localMeshes, const std::vector<TaskGroup> &taskGroups, int numThreads)
+{
+    size_t numCells = localMeshes.size();
+    std::vector<CellMailboxes> mailboxes(numCells);
+    std::vector<std::unique_ptr<ThreadHaloTransport>> transports;
+    for (size_t cell = 0; cell < numCells; ++cell)
+    {
+        transports.push_back(std::make_unique<ThreadHaloTransport>(mailboxes, cell, localMeshes[cell]));
+    }
+    std::vector<std::optional<PhaseState>> states(numCells);
+    // a cell is run by one worker per step and the barrier orders the steps, so plain counters do
+    std::vector<size_t> cellSteps(numCells, 0);
+
+    std::vector<StealingDeque> deques(numThreads);
+    std::barrier<> barrier(numThreads);
+    std::atomic<size_t> steals{0};
+
+    auto worker = [&](int thread)
+    {
+        std::vector<size_t> cells = ownCells(numCells, thread, numThreads);
+        for (int phase = 0; phase < int(taskGroups.size()); ++phase)
+        {
+            for (int step = 0; step < 2; ++step)
+            {
+                deques[thread].reset(cells);
+                barrier.arrive_and_wait();
+
+                size_t cell;
+                while (nextCell(deques, thread, cell, steals))
+                {
+                    cellSteps[cell] += 1;
+                    if (step == 0)
+                    {
+                        states[cell].emplace(startPhase(localMeshes[cell], taskGroups[phase], phase, *transports[cell]));
+                    }
+                    else
+                    {
+                        finishPhase(localMeshes[cell], *states[cell], *transports[cell]);
+                        // the state lives in the cell's arena, drop it before the next reset
+                        states[cell].reset();
+                    }
+                }
+                barrier.arrive_and_wait();
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int thread = 0; thread < numThreads; ++thread)
+    {
+        workers.emplace_back(worker, thread);
+    }
+    for (auto &thread : workers)
+    {
+        thread.join();
+    }
+
+    ThreadedStats stats;
+    for (auto &transport : transports)
+    {
+        stats.halo.push_back(transport->stats);
+    }
+    stats.cellSteps = cellSteps;
+    stats.steps = std::accumulate(cellSteps.begin(), cellSteps.end(), size_t(0));
+    stats.steals = steals.load();
+    return stats;
+}
+
+/*
+Same as saveCurveOrdered, with the per-cell sorts run by numThreads workers that take
+cells as in runThreaded, stealing once their own run is done.
+*/
+void saveCurveOrdered(std::vector<LocalMesh> &localMeshes, const std::string &path, Curve curve, int numThreads)
+{
+    Bbox2 domain;
+    for (auto &localMesh : localMeshes)
+    {
+        domain.add(localMesh.bbox);
+    }
+    SfcQuantizer quantizer(domain, curve);
+
+    // the deques are filled before any worker starts, so no barrier is needed
+    std::vector<SortedMesh> parts(localMeshes.size());
+    std::vector<StealingDeque> deques(numThreads);
+    for (int thread = 0; thread < numThreads; ++thread)
+    {
+        deques[thread].reset(ownCells(localMeshes.size(), thread, numThreads));
+    }
+    std::atomic<size_t> steals{0};
+    std::vector<std::thread> workers;
+    for (int thread = 0; thread < numThreads; ++thread)
+    {
+        workers.emplace_back([&, thread]()
+                             {
+                                 size_t cell;
+                                 while (nextCell(deques, thread, cell, steals))
+                                 {
+                                     LocalMesh &localMesh = localMeshes[cell];
+                                     parts[cell] = sortOwnedTriangles(localMesh.mesh, localMesh.bbox, quantizer, localMesh.heights,
+                                                                      [&](const Point2 &p) { return localMesh.isInsideDomain(p); });
+                                 } });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    SortedMesh merged;
+    if (mergeSortedMeshes(parts, merged))
+    {
+        writePly(merged.coordinates, merged.heights, merged.triangles, path);
+    }
+}
@@ -0,0 +1,595 @@
+#pragma once
+
+#include <mpi.h>
+#include <atomic>
+#include <cstring>
+
+#include "halo.hpp"
+
+// MPI HALO TRANSPORTS
+
+/*
+Tag of the point-to-point halo messages of a phase. A message that is still in flight
+from one phase can never match a receive posted for another.
+*/
+inline int phaseTag(int phase)
+{
+    return phase + 1;
+}
+
+/*
+Point-to-point Boost.MPI transport: the halo is triangulated into a SerializableMesh
+and goes through the Boost archive, tagged with the phase (see phaseTag).
+*/
+class BoostHaloTransport : public HaloTransport
+{
+private:
+    struct Pending
+    {
+        mpi::request request;
+        Neighbor neighbor;
+        std::unique_ptr<SerializableMesh> buffer;
+    };
+
+    mpi::communicator world;
+    LocalMesh &localMesh;
+    std::vector<Pending> receives, sends;
+
+public:
+    BoostHaloTransport(const mpi::communicator &world, LocalMesh &localMesh) : world(world), localMesh(localMesh) {}
+
+    const char *name() const override { return "boost"; }
+
+    void postReceives(int phase, const std::vector<Neighbor> &sources) override
+    {
+        HaloTimer timer(stats);
+        for (Neighbor source : sources)
+        {
+            Pending pending{mpi::request(), source, std::make_unique<SerializableMesh>()};
+            pending.request = world.irecv(int(localMesh.neighbors[source].value()), phaseTag(phase), *pending.buffer);
+            receives.push_back(std::move(pending));
+        }
+    }
+
+    void send(int phase, Neighbor target, HaloPayload payload) override
+    {
+        HaloTimer timer(stats);
+        Pending pending{mpi::request(), target, std::make_unique<SerializableMesh>()};
+        bulkInsert(*pending.buffer, payload.points, localMesh.insertionOrder, &localMesh.insertionStats);
+        pending.buffer->constraintSegments.assign(payload.segments.begin(), payload.segments.end());
+        pending.request = world.isend(int(localMesh.neighbors[target].value()), phaseTag(phase), *pending.buffer);
+        sends.push_back(std::move(pending));
+        stats.messages += 1;
+        stats.bytes += haloBytes(payload);
+    }
+
+    void complete(const std::function<void(Neighbor, HaloPayload &)> &deliver) override
+    {
+        HaloTimer timer(stats);
+        while (!receives.empty() || !sends.empty())
+        {
+            for (auto it = sends.begin(); it != sends.end();)
+            {
+                it = it->request.test() ? sends.erase(it) : it + 1;
+            }
+            for (auto it = receives.begin(); it != receives.end();)
+            {
+                if (it->request.test())
+                {
+                    HaloPayload payload;
+                    std::vector<Point2 *> vertices;
+                    it->buffer->getVertexPointers(vertices);
+                    for (auto &vertex : vertices)
+                    {
+                        payload.points.push_back(*vertex);
+                    }
+                    payload.segments.assign(it->buffer->constraintSegments.begin(), it->buffer->constraintSegments.end());
+                    deliver(it->neighbor, payload);
+                    it = receives.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+    }
+};
+
+/*
+Raw MPI transport: contiguous packHalo buffers sent as MPI_BYTE on a private duplicate of
+the world communicator, no archive and no intermediate triangulation. Receives are sized
+by a matched probe (MPI_Improbe + MPI_Get_count) and received with MPI_Imrecv, so a
+variable sized halo is received in place without a size message and without blocking.
+*/
+class RawHaloTransport : public HaloTransport
+{
+private:
+    struct Receive
+    {
+        Neighbor neighbor;
+        int source;
+        int tag;
+        bool started = false;
+        MPI_Request request = MPI_REQUEST_NULL;
+        std::vector<double> buffer;
+    };
+
+    struct Send
+    {
+        MPI_Request request = MPI_REQUEST_NULL;
+        std::vector<double> buffer;
+    };
+
+    MPI_Comm comm = MPI_COMM_NULL;
+    bool ownsComm = false;
+    std::vector<Receive> receives;
+    std::vector<std::unique_ptr<Send>> sends; // stable addresses while MPI owns the buffers
+
+protected:
+    LocalMesh &localMesh;
+
+    // where the halo to or from neighbor goes, and its tag (neighbors are ranks here)
+    virtual int peerRank(Neighbor neighbor) const
+    {
+        return int(localMesh.neighbors.at(neighbor).value());
+    }
+
+    virtual int receiveTag(int phase, Neighbor /* source */) const
+    {
+        return phaseTag(phase);
+    }
+
+    virtual int sendTag(int phase, Neighbor /* target */) const
+    {
+        return phaseTag(phase);
+    }
+
+public:
+    RawHaloTransport(const mpi::communicator &world, LocalMesh &localMesh) : localMesh(localMesh)
+    {
+        MPI_Comm_dup(MPI_Comm(world), &comm);
+        ownsComm = true;
+    }
+
+    // on a communicator shared with other transports of this rank, freed by its owner
+    RawHaloTransport(MPI_Comm shared, LocalMesh &localMesh) : comm(shared), localMesh(localMesh) {}
+
+    RawHaloTransport(const RawHaloTransport &) = delete;
+    RawHaloTransport &operator=(const RawHaloTransport &) = delete;
+
+    ~RawHaloTransport()
+    {
+        if (ownsComm)
+        {
+            MPI_Comm_free(&comm);
+        }
+    }
+
+    const char *name() const override { return "raw"; }
+
+    void postReceives(int phase, const std::vector<Neighbor> &sources) override
+    {
+        // the size is unknown until the message arrives, complete() probes for it
+        for (Neighbor source : sources)
+        {
+            Receive receive;
+            receive.neighbor = source;
+            receive.source = peerRank(source);
+            receive.tag = receiveTag(phase, source);
+            receives.push_back(std::move(receive));
+        }
+    }
+
+    void send(int phase, Neighbor target, HaloPayload payload) override
+    {
+        HaloTimer timer(stats);
+        auto pending = std::make_unique<Send>();
+        packHalo(payload, pending->buffer);
+        MPI_Isend(pending->buffer.data(), int(pending->buffer.size() * sizeof(double)), MPI_BYTE,
+                  peerRank(target), sendTag(phase, target), comm, &pending->request);
+        sends.push_back(std::move(pending));
+        stats.messages += 1;
+        stats.bytes += haloBytes(payload);
+    }
+
+    void complete(const std::function<void(Neighbor, HaloPayload &)> &deliver) override
+    {
+        HaloTimer timer(stats);
+        while (!receives.empty() || !sends.empty())
+        {
+            for (auto it = sends.begin(); it != sends.end();)
+            {
+                int done = 0;
+                MPI_Test(&(*it)->request, &done, MPI_STATUS_IGNORE);
+                it = done ? sends.erase(it) : it + 1;
+            }
+            for (auto it = receives.begin(); it != receives.end();)
+            {
+                if (!it->started)
+                {
+                    int found = 0;
+                    MPI_Message message;
+                    MPI_Status status;
+                    MPI_Improbe(it->source, it->tag, comm, &found, &message, &status);
+                    if (found)
+                    {
+                        int bytes = 0;
+                        MPI_Get_count(&status, MPI_BYTE, &bytes);
+                        it->buffer.resize(size_t(bytes) / sizeof(double));
+                        MPI_Imrecv(it->buffer.data(), bytes, MPI_BYTE, &message, &it->request);
+                        it->started = true;
+                    }
+                }
+                int done = 0;
+                if (it->started)
+                {
+                    MPI_Test(&it->request, &done, MPI_STATUS_IGNORE);
+                }
+                if (done)
+                {
+                    HaloPayload payload = unpackHalo(it->buffer.data(), it->buffer.size());
+                    deliver(it->neighbor, payload);
+                    it = receives.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+    }
+};
+
+/*
+Halo exchange over an MPI distributed graph communicator of the 8-neighbor block
+topology, built once from LocalMesh::neighbors. Every phase is one MPI_Neighbor_alltoall
+of the payload sizes and one MPI_Neighbor_alltoallv of the payloads, so the library sees
+the whole pattern up front. Collectives on the graph communicator match in call order,
+which keeps the phases apart without tags.
+*/
+class GraphHaloTransport : public HaloTransport
+{
+private:
+    MPI_Comm graph = MPI_COMM_NULL;
+    std::vector<Neighbor> slots; // direction of the neighbor at each position of the graph
+    std::vector<Neighbor> sources;
+    std::unordered_map<Neighbor, HaloPayload> outgoing;
+
+public:
+    GraphHaloTransport(const mpi::communicator &world, const LocalMesh &localMesh)
+    {
+        // the relation is symmetric (I am the Left of my Right), so sources == destinations
+        std::vector<int> ranks;
+        for (Neighbor neighbor : allNeighbors)
+        {
+            auto it = localMesh.neighbors.find(neighbor);
+            if (it != localMesh.neighbors.end() && it->second.has_value())
+            {
+                slots.push_back(neighbor);
+                ranks.push_back(int(it->second.value()));
+            }
+        }
+        int degree = int(ranks.size());
+        MPI_Dist_graph_create_adjacent(MPI_Comm(world), degree, ranks.data(), MPI_UNWEIGHTED,
+                                       degree, ranks.data(), MPI_UNWEIGHTED, MPI_INFO_NULL, 0, &graph);
+    }
+
+    GraphHaloTransport(const GraphHaloTransport &) = delete;
+    GraphHaloTransport &operator=(const GraphHaloTransport &) = delete;
+
+    ~GraphHaloTransport()
+    {
+        if (graph != MPI_COMM_NULL)
+        {
+            MPI_Comm_free(&graph);
+        }
+    }
+
+    const char *name() const override { return "graph"; }
+
+    void postReceives(int /* phase */, const std::vector<Neighbor> &sources) override
+    {
+        this->sources = sources;
+    }
+
+    void send(int /* phase */, Neighbor target, HaloPayload payload) override
+    {
+        stats.messages += 1;
+        stats.bytes += haloBytes(payload);
+        outgoing.emplace(target, std::move(payload));
+    }
+
+    /*
+    Collective: every rank of the graph must complete the phase (nothing is sent to
+    neighbors without a payload, payloads from neighbors not in sources are dropped).
+    */
+    void complete(const std::function<void(Neighbor, HaloPayload &)> &deliver) override
+    {
+        HaloTimer timer(stats);
+        int degree = int(slots.size());
+        std::vector<double> sendData;
+        std::vector<int> sendCounts(degree, 0), sendOffsets(degree, 0);
+        for (int slot = 0; slot < degree; ++slot)
+        {
+            sendOffsets[slot] = int(sendData.size());
+            auto it = outgoing.find(slots[slot]);
+            if (it != outgoing.end())
+            {
+                packHalo(it->second, sendData);
+            }
+            sendCounts[slot] = int(sendData.size()) - sendOffsets[slot];
+        }
+        outgoing.clear();
+
+        std::vector<int> receiveCounts(degree, 0), receiveOffsets(degree, 0);
+        MPI_Neighbor_alltoall(sendCounts.data(), 1, MPI_INT, receiveCounts.data(), 1, MPI_INT, graph);
+        int total = 0;
+        for (int slot = 0; slot < degree; ++slot)
+        {
+            receiveOffsets[slot] = total;
+            total += receiveCounts[slot];
+        }
+        std::vector<double> receiveData(total);
+        MPI_Neighbor_alltoallv(sendData.data(), sendCounts.data(), sendOffsets.data(), MPI_DOUBLE,
+                               receiveData.data(), receiveCounts.data(), receiveOffsets.data(), MPI_DOUBLE, graph);
+
+        for (int slot = 0; slot < degree; ++slot)
+        {
+            if (std::find(sources.begin(), sources.end(), slots[slot]) != sources.end())
+            {
+                HaloPayload payload = unpackHalo(receiveData.data() + receiveOffsets[slot], size_t(receiveCounts[slot]));
+                deliver(slots[slot], payload);
+            }
+        }
+    }
+};
+
+/*
+Intra-node transport over an MPI-3 shared memory window. Every rank of a node owns one
+segment of the window: a header with one slot per direction plus a data area into which
+its outgoing halos are packed. A same-node neighbor unpacks straight from that segment once
+the slot's sequence number says the phase is published, and acknowledges in its own header,
+so a halo is copied once (the pack) instead of going through the point-to-point stack.
+Neighbors on other nodes, and halos that do not fit the data area, go over the raw transport.
+*/
+class ShmHaloTransport : public HaloTransport
+{
+private:
+    static constexpr uint64_t overflow = ~uint64_t(0); // slot offset of a halo sent as a message
+
+    struct Slot
+    {
+        uint64_t sequence; // phaseTag of the published halo, 0 if none yet
+        uint64_t offset;   // in doubles from the start of the data area, or overflow
+        uint64_t count;    // in doubles
+    };
+
+    struct Header
+    {
+        Slot slots[8];     // outgoing halo per direction (as seen from the owner)
+        uint64_t acks[8];  // sequence of the last halo consumed from the neighbor in each direction
+    };
+
+    struct Receive
+    {
+        Neighbor neighbor;
+        int nodeRank;
+    };
+
+    struct Send
+    {
+        int nodeRank;
+        Neighbor neighbor;
+    };
+
+    MPI_Comm node = MPI_COMM_NULL;
+    MPI_Win window = MPI_WIN_NULL;
+    int self;        // rank in node
+    size_t capacity; // doubles in the data area of each segment
+    std::unordered_map<Neighbor, int> nodeRanks; // node rank of every same-node neighbor
+    std::unique_ptr<RawHaloTransport> fallback;
+
+    int phase = 0;
+    uint64_t sequence = 0;
+    size_t used = 0; // doubles of the data area used in the current phase
+    std::vector<Receive> receives;
+    std::vector<Send> sends;
+
+    Header *header(int nodeRank)
+    {
+        MPI_Aint size;
+        int dispUnit;
+        void *base;
+        MPI_Win_shared_query(window, nodeRank, &size, &dispUnit, &base);
+        return static_cast<Header *>(base);
+    }
+
+    double *data(int nodeRank)
+    {
+        return reinterpret_cast<double *>(header(nodeRank) + 1);
+    }
+
+    static uint64_t load(uint64_t &value)
+    {
+        return std::atomic_ref<uint64_t>(value).load(std::memory_order_acquire);
+    }
+
+    static void store(uint64_t &value, uint64_t newValue)
+    {
+        std::atomic_ref<uint64_t>(value).store(newValue, std::memory_order_release);
+    }
+
+public:
+    ShmHaloTransport(const mpi::communicator &world, LocalMesh &localMesh, size_t bytes)
+        : capacity(bytes / sizeof(double)), fallback(std::make_unique<RawHaloTransport>(world, localMesh))
+    {
+        MPI_Comm_split_type(MPI_Comm(world), MPI_COMM_TYPE_SHARED, world.rank(), MPI_INFO_NULL, &node);
+        MPI_Comm_rank(node, &self);
+
+        void *base;
+        MPI_Win_allocate_shared(MPI_Aint(sizeof(Header) + capacity * sizeof(double)), 1, MPI_INFO_NULL, node, &base, &window);
+        std::memset(base, 0, sizeof(Header));
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, window);
+        MPI_Win_sync(window);
+        MPI_Barrier(node);
+
+        MPI_Group worldGroup, nodeGroup;
+        MPI_Comm_group(MPI_Comm(world), &worldGroup);
+        MPI_Comm_group(node, &nodeGroup);
+        for (Neighbor neighbor : allNeighbors)
+        {
+            auto it = localMesh.neighbors.find(neighbor);
+            if (it == localMesh.neighbors.end() || !it->second.has_value())
+            {
+                continue;
+            }
+            int worldRank = int(it->second.value()), nodeRank;
+            MPI_Group_translate_ranks(worldGroup, 1, &worldRank, nodeGroup, &nodeRank);
+            if (nodeRank != MPI_UNDEFINED)
+            {
+                nodeRanks[neighbor] = nodeRank;
+            }
+        }
+        MPI_Group_free(&worldGroup);
+        MPI_Group_free(&nodeGroup);
+    }
+
+    ShmHaloTransport(const ShmHaloTransport &) = delete;
+    ShmHaloTransport &operator=(const ShmHaloTransport &) = delete;
+
+    ~ShmHaloTransport()
+    {
+        fallback.reset();
+        if (window != MPI_WIN_NULL)
+        {
+            MPI_Win_unlock_all(window);
+            MPI_Win_free(&window);
+        }
+        if (node != MPI_COMM_NULL)
+        {
+            MPI_Comm_free(&node);
+        }
+    }
+
+    const char *name() const override { return "shm"; }
+
+    void postReceives(int phase, const std::vector<Neighbor> &sources) override
+    {
+        this->phase = phase;
+        sequence = uint64_t(phaseTag(phase));
+        used = 0;
+        std::vector<Neighbor> remote;
+        for (Neighbor source : sources)
+        {
+            auto it = nodeRanks.find(source);
+            if (it != nodeRanks.end())
+            {
+                receives.push_back(Receive{source, it->second});
+            }
+            else
+            {
+                remote.push_back(source);
+            }
+        }
+        fallback->postReceives(phase, remote);
+    }
+
+    void send(int phase, Neighbor target, HaloPayload payload) override
+    {
+        HaloTimer timer(stats);
+        stats.messages += 1;
+        stats.bytes += haloBytes(payload);
+        auto it = nodeRanks.find(target);
+        if (it == nodeRanks.end())
+        {
+            fallback->send(phase, target, std::move(payload));
+            return;
+        }
+
+        Slot &slot = header(self)->slots[int(target)];
+        size_t count = haloBytes(payload) / sizeof(double);
+        if (used + count <= capacity)
+        {
+            // the only copy of a same-node halo: packed straight into the shared segment
+            packHalo(payload, data(self) + used);
+            slot.offset = used;
+            slot.count = count;
+            used += count;
+        }
+        else
+        {
+            fallback->send(phase, target, std::move(payload));
+            slot.offset = overflow;
+            slot.count = 0;
+        }
+        MPI_Win_sync(window);
+        store(slot.sequence, sequence);
+        sends.push_back(Send{it->second, target});
+    }
+
+    void complete(const std::function<void(Neighbor, HaloPayload &)> &deliver) override
+    {
+        HaloTimer timer(stats);
+
+        // same-node halos, read in place as soon as they are published
+        std::vector<Neighbor> overflowed;
+        while (!receives.empty())
+        {
+            for (auto it = receives.begin(); it != receives.end();)
+            {
+                // the sender sees this rank in the opposite direction
+                Slot &slot = header(it->nodeRank)->slots[int(opposite(it->neighbor))];
+                if (load(slot.sequence) != sequence)
+                {
+                    ++it;
+                    continue;
+                }
+                MPI_Win_sync(window);
+                if (slot.offset == overflow)
+                {
+                    overflowed.push_back(it->neighbor);
+                }
+                else
+                {
+                    HaloPayload payload = unpackHalo(data(it->nodeRank) + slot.offset, slot.count);
+                    deliver(it->neighbor, payload);
+                }
+                store(header(self)->acks[int(it->neighbor)], sequence);
+                it = receives.erase(it);
+            }
+        }
+
+        // other nodes and overflowed halos
+        if (!overflowed.empty())
+        {
+            fallback->postReceives(phase, overflowed);
+        }
+        fallback->complete(deliver);
+
+        // the data area is reused next phase, wait until every same-node neighbor has read it
+        while (!sends.empty())
+        {
+            for (auto it = sends.begin(); it != sends.end();)
+            {
+                uint64_t ack = load(header(it->nodeRank)->acks[int(opposite(it->neighbor))]);
+                it = ack == sequence ? sends.erase(it) : it + 1;
+            }
+        }
+        MPI_Win_sync(window);
+    }
+};
+
+/*
+Transport by name (graph, boost, raw or shm), nullptr for an unknown name.
+Must be called collectively once the neighbors of localMesh are final.
+*/
+std::unique_ptr<HaloTransport> makeHaloTransport(const std::string &name, const mpi::communicator &world, LocalMesh &localMesh,
+                                                 const RuntimeParameters &params)
+{
+    if (name == "graph") return std::make_unique<GraphHaloTransport>(world, localMesh);
+    if (name == "boost") return std::make_unique<BoostHaloTransport>(world, localMesh);
+    if (name == "raw") return std::make_unique<RawHaloTransport>(world, localMesh);
+    if (name == "shm") return std::make_unique<ShmHaloTransport>(world, localMesh, params.haloShmBytes);
+    return nullptr;
+}